@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "globals.h"
+
+#define ARENA_CHUNK (2UL << 20)
+#define ARENA_ALIGN 8
+#define ARENA_CLASSES 48
+#define ARENA_SMALL 256
+
+struct arena_chunk {
+	/* next chunk in arena */
+	struct arena_chunk *next;
+	/* size of the mapping, including this header */
+	size_t size;
+};
+
+struct arena {
+	/* all chunks, most recent first */
+	struct arena_chunk *chunks;
+	/* free space in the current chunk */
+	char *cur, *end;
+	/* released blocks, one list per power of two */
+	void *free[ARENA_CLASSES];
+	/* released small blocks, one list per size */
+	void *small[ARENA_SMALL / ARENA_ALIGN + 1];
+	/* statistics */
+	size_t used, reserved;
+	int hugepages;
+};
+
+struct arena *arena_new(int hugepages)
+{
+	struct arena *ret = calloc(1, sizeof(*ret));
+	ret->hugepages = hugepages;
+	return ret;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c, *n;
+
+	for (c = a->chunks; c; c = n) {
+		n = c->next;
+		munmap(c, c->size);
+	}
+	free(a);
+}
+
+void arena_adopt(struct arena *dst, struct arena *src)
+{
+	struct arena_chunk *c;
+
+	if (src->chunks) {
+		for (c = src->chunks; c->next; c = c->next);
+		c->next = dst->chunks;
+		dst->chunks = src->chunks;
+	}
+	/* keep allocating from the current chunk of dst */
+	if (!dst->cur) {
+		dst->cur = src->cur;
+		dst->end = src->end;
+	}
+	dst->used += src->used;
+	dst->reserved += src->reserved;
+	free(src);
+}
+
+static struct arena_chunk *arena_map(size_t size, int hugepages)
+{
+	char *p, *q;
+
+	if (!hugepages) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("Unable to allocate %lu bytes", size);
+		return (struct arena_chunk *)p;
+	}
+
+	/* over-allocate and trim to get a huge page aligned mapping */
+	p = mmap(NULL, size + ARENA_CHUNK, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		die("Unable to allocate %lu bytes", size);
+	q = (char *)(((size_t)p + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1));
+	if (q > p)
+		munmap(p, q - p);
+	if (p + ARENA_CHUNK > q)
+		munmap(q + size, p + ARENA_CHUNK - q);
+	madvise(q, size, MADV_HUGEPAGE);
+	return (struct arena_chunk *)q;
+}
+
+/* list of released blocks of sz bytes, NULL if they are not reused */
+static void **arena_free_list(struct arena *a, size_t sz)
+{
+	int c;
+
+	if (!(sz & (sz - 1))) {
+		c = __builtin_ctzl(sz);
+		return c < ARENA_CLASSES ? &a->free[c] : NULL;
+	}
+	if (sz <= ARENA_SMALL && !(sz % ARENA_ALIGN))
+		return &a->small[sz / ARENA_ALIGN];
+	return NULL;
+}
+
+void *arena_alloc(struct arena *a, size_t sz)
+{
+	void **fl = arena_free_list(a, sz);
+	struct arena_chunk *c;
+	size_t csz;
+	void *ret;
+
+	if (fl && *fl) {
+		ret = *fl;
+		*fl = *(void **)ret;
+		return ret;
+	}
+
+	sz = (sz + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((size_t)(a->end - a->cur) < sz) {
+		csz = sz + sizeof(*c);
+		csz = (csz + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1);
+		c = arena_map(csz, a->hugepages);
+		c->size = csz;
+		c->next = a->chunks;
+		a->chunks = c;
+		a->cur = (char *)(c + 1);
+		a->end = (char *)c + csz;
+		a->reserved += csz;
+	}
+
+	ret = a->cur;
+	a->cur += sz;
+	a->used += sz;
+	return ret;
+}
+
+void arena_release(struct arena *a, void *p, size_t sz)
+{
+	void **fl = arena_free_list(a, sz);
+
+	if (!fl || sz < sizeof(void *))
+		return;
+	*(void **)p = *fl;
+	*fl = p;
+}
+
+size_t arena_used(const struct arena *a)
+{
+	return a->used;
+}
+
+size_t arena_reserved(const struct arena *a)
+{
+	return a->reserved;
+}
@@ -0,0 +1,44 @@
+/**
+ * Region allocator for many small objects released together.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+struct arena;
+
+/**
+ * Create an empty arena. If hugepages is set, memory is requested in 2MB
+ * aligned chunks backed by transparent huge pages.
+ */
+struct arena *arena_new(int hugepages);
+
+/**
+ * Release all the memory of the arena in one go.
+ */
+void arena_free(struct arena *a);
+
+/**
+ * Move all the memory of src to dst and free src. Blocks allocated from src
+ * stay valid and are freed with dst.
+ */
+void arena_adopt(struct arena *dst, struct arena *src);
+
+/**
+ * Allocate sz bytes, 8-byte aligned. Fresh memory is zeroed, memory reused
+ * after arena_release is not.
+ */
+void *arena_alloc(struct arena *a, size_t sz);
+
+/**
+ * Give back a block whose size is a power of two or a multiple of 8 up to 256
+ * bytes, so that later requests of the same size can reuse it. Other blocks
+ * are only freed with the arena.
+ */
+void arena_release(struct arena *a, void *p, size_t sz);
+
+/* bytes handed out by the arena, including released blocks */
+size_t arena_used(const struct arena *a);
+/* bytes mapped by the arena */
+size_t arena_reserved(const struct arena *a);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "dp2d.h"
 #include "fp.h"
@@ -20,16 +21,31 @@ static struct {
 	size_t lmax;
 	/* num items (to be removed later) */
 	size_t ni;
+	/* number of threads used to parse the transactions */
+	size_t threads;
+	/* allocate tree nodes from transparent huge pages */
+	int hugepages;
+	/* memory for the support cache, in MB */
+	size_t cache_mb;
+	/* count supports of the top NI items on tidsets */
+	int vertical;
+	/* filename to save the fp-tree snapshot to, if any */
+	char *sfname;
+	/* filename of transactions appended to the tree, if any */
+	char *afname;
+	/* fraction of items changing rank before the tree is rebuilt */
+	double drift;
 } args;
 
 static void usage(const char *prg)
 {
-	fprintf(stderr, "Usage: %s TFILE RMAX NI\n", prg);
+	fprintf(stderr, "Usage: %s [-j THREADS] [-m CACHE_MB] [-H] [-v] [-s SNAPSHOT] [-a APPEND_FILE] [-d DRIFT] TFILE RMAX NI\n", prg);
 	exit(EXIT_FAILURE);
 }
 
 static void parse_arguments(int argc, char **argv)
 {
+	const char *prg = argv[0];
 	int i;
 
 	printf("Called with: argc=%d\n", argc);
@@ -37,13 +53,53 @@ static void parse_arguments(int argc, char **argv)
 		printf("%s ", argv[i]);
 	printf("\n");
 
+	args.threads = 1;
+	args.hugepages = 0;
+	args.cache_mb = 64;
+	args.vertical = 0;
+	args.sfname = NULL;
+	args.afname = NULL;
+	args.drift = 0.05;
+	while ((i = getopt(argc, argv, "j:m:vs:a:d:H")) != -1)
+		switch (i) {
+		case 'j':
+			if (sscanf(optarg, "%lu", &args.threads) != 1 || !args.threads)
+				usage(prg);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%lu", &args.cache_mb) != 1)
+				usage(prg);
+			break;
+		case 'v':
+			args.vertical = 1;
+			break;
+		case 's':
+			args.sfname = strdup(optarg);
+			break;
+		case 'a':
+			args.afname = strdup(optarg);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%lf", &args.drift) != 1 || args.drift < 0)
+				usage(prg);
+			break;
+		case 'H':
+			args.hugepages = 1;
+			break;
+		default:
+			usage(prg);
+		}
+	/* positional arguments start at argv[1] */
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	if (argc != 4)
-		usage(argv[0]);
+		usage(prg);
 	args.tfname = strdup(argv[1]);
 	if (sscanf(argv[2], "%lu", &args.lmax) != 1 || args.lmax < 2 || args.lmax > 7)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[3], "%lu", &args.ni) != 1)
-		usage(argv[0]);
+		usage(prg);
 }
 
 int main(int argc, char **argv)
@@ -52,17 +108,30 @@ int main(int argc, char **argv)
 	struct fptree fp;
 
 	parse_arguments(argc, argv);
+	if (args.hugepages)
+		fpt_use_hugepages(1);
 
-	fpt_read_from_file(args.tfname, &fp);
+	fpt_read_from_file(args.tfname, args.threads, &fp);
+	if (args.afname)
+		fpt_append_file(&fp, args.afname, args.threads, args.drift);
+	fpt_freeze(&fp);
+	if (args.sfname)
+		fpt_save_snapshot(&fp, args.sfname);
+	fpt_enable_cache(&fp, args.cache_mb << 20);
+	if (args.vertical)
+		fpt_build_vertical(&fp, args.ni);
 	printf("fp-tree: items: %lu, transactions: %lu, nodes: %d, depth: %d\n",
 			fp.n, fp.t, fpt_nodes(&fp), fpt_height(&fp));
 
 	itst = build_recall_tree(&fp, args.lmax, min(fp.n, args.ni));
+	fpt_print_cache_stats(&fp);
 	save_its(itst, args.tfname, args.lmax, args.ni);
 
 	free_itstree(itst);
 	fpt_cleanup(&fp);
 	free(args.tfname);
+	free(args.sfname);
+	free(args.afname);
 
 	return 0;
 }
@@ -1,14 +1,18 @@
 #include <math.h>
+#include <pthread.h>
 #include <search.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include "dp2d.h"
 #include "fp.h"
 #include "globals.h"
+#include "hashset.h"
 #include "histogram.h"
 #include "itstree.h"
+#include "pool.h"
 #include "rs.h"
 
 #define MICROSECONDS 1000000L
@@ -46,6 +50,9 @@
 #define EM_REDFUN max
 #endif
 
+/* kernels specialized on lmax must be inlined in each instance */
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
 enum quality_fun {
 	EM_QD = 0,
 	EM_QDELTA,
@@ -55,10 +62,88 @@ static const enum quality_fun QMETHOD = EM_QSIGMA;
 
 struct item_count {
 	int value;
+	int rank;
 	int real_count;
 	double noisy_count;
 };
 
+/**
+ * Itemsets already generated, as packed keys in a hash set or, if the
+ * candidates do not fit in a key, in an itemset tree.
+ */
+struct seen_its {
+	struct hashset *set;
+	struct itstree_node *itst;
+};
+
+struct mining;
+struct miner;
+
+/* generates the rules of a leaf, one instance per value of lmax */
+typedef void (*generate_rules_fun)(const struct mining *m, struct miner *w,
+		const int *items);
+/* samples the last items of leaves, one instance per value of lmax */
+typedef struct reservoir *(*sample_leaves_fun)(const struct mining *m,
+		const int *celms, const int *sups, struct seen_its *seen,
+		struct rng *rng);
+
+/* results of one worker, merged at the end */
+struct miner {
+	struct histogram *h;
+	double minc;
+	double maxc;
+};
+
+/* state shared by all the branches of the sampling tree */
+struct mining {
+	const struct fptree *fp;
+	const struct item_count *ic;
+	size_t numits;
+	size_t lmax;
+	double c0;
+	double *epss;
+	size_t *spls;
+	/* itemsets generated by this run, with their private recall counts */
+	struct itstree_node *itst;
+	/* itemsets generated so far, guarded by lock when mining in parallel */
+	struct seen_its seen;
+	pthread_mutex_t *lock;
+	/* bits per item in a packed itemset key, 0 if they do not fit */
+	int keybits;
+	generate_rules_fun generate_rules;
+	sample_leaves_fun sample_leaves;
+	/* branches starting at this level are mined by the pool, 0 if none */
+	size_t depth;
+	struct pool *pool;
+	long int seed;
+	enum rng_engine engine;
+	/* mine level by level, counting the candidates of a level together */
+	int bfs;
+	/* conditional pattern base of the empty prefix, NULL if not used */
+	struct fpt_base *base;
+	/* position in ic of each item value - 1, -1 if not a candidate */
+	int *slots;
+	/* one per worker of the pool */
+	struct miner *miners;
+	/* report of the run */
+	FILE *out;
+};
+
+/* a prefix on the frontier of a breadth first run */
+struct frontier_item {
+	int path[FPT_MAXLEN];
+	/* ranks of path, sorted, unused entries 0 */
+	int key[FPT_MAXLEN];
+	/* position in the frontier */
+	size_t ix;
+};
+
+/* a subtree of the sampling tree, rooted at the end of path */
+struct branch {
+	const struct mining *m;
+	int path[FPT_MAXLEN];
+};
+
 static int ic_noisy_cmp(const void *a, const void *b)
 {
 	const struct item_count *ia = a, *ib = b;
@@ -79,19 +164,25 @@ static inline void print_item_table(const struct item_count *ic, size_t n)
 #endif
 
 static size_t build_items_table(const struct fptree *fp, struct item_count *ic,
-		double eps, struct drand48_data *buffer)
+		double eps, struct rng *rng, FILE *out)
 {
+	double *counts = malloc(fp->n * sizeof(counts[0]));
 	size_t i;
 
-	printf("Compute noisy counts for items with eps = %lf\n", eps);
+	fprintf(out, "Compute noisy counts for items with eps = %lf\n", eps);
 	for (i = 0; i < fp->n; i++) {
 		ic[i].value = i + 1;
+		ic[i].rank = fpt_item_rank(fp, i + 1);
 		ic[i].real_count = fpt_item_count(fp, i);
-		ic[i].noisy_count = laplace_mechanism(ic[i].real_count, eps,
-				1, buffer);
+		counts[i] = ic[i].real_count;
+	}
+	laplace_mechanism_batch(counts, counts, fp->n, eps, 1, rng);
+	for (i = 0; i < fp->n; i++) {
+		ic[i].noisy_count = counts[i];
 		if (ic[i].noisy_count < 0)
 			ic[i].noisy_count = 0;
 	}
+	free(counts);
 
 	qsort(ic, fp->n, sizeof(ic[0]), ic_noisy_cmp);
 
@@ -99,7 +190,7 @@ static size_t build_items_table(const struct fptree *fp, struct item_count *ic,
 	print_item_table(ic, fp->n);
 #endif
 
-	printf("Noise scale: %5.2f\n", SCALE_FACTOR/eps);
+	fprintf(out, "Noise scale: %5.2f\n", SCALE_FACTOR/eps);
 	for (i = 0; i < fp->n; i++)
 		if (ic[i].noisy_count < SCALE_FACTOR / eps)
 			return i;
@@ -128,22 +219,29 @@ static void print_this_rule(const int *A, const int* AB,
 #endif
 
 /**
- * Checks whether the current itemset has been generated previously
+ * Copies a short itemset to cf, sorted.
  */
-static int its_already_seen(int *its, size_t itslen,
-		const struct itstree_node *itst)
+static inline void sort_its(const int *its, size_t itslen, int *cf)
 {
-	int *cf = calloc(itslen, sizeof(cf[0]));
-	size_t i, ret = 0;
+	size_t i, j;
 
-	for (i = 0; i < itslen; i++)
-		cf[i] = its[i];
+	for (i = 0; i < itslen; i++) {
+		for (j = i; j > 0 && cf[j - 1] > its[i]; j--)
+			cf[j] = cf[j - 1];
+		cf[j] = its[i];
+	}
+}
 
-	qsort(cf, itslen, sizeof(cf[0]), int_cmp);
-	ret = search_its_private(itst, cf, itslen);
+/**
+ * Checks whether the current itemset has been generated previously
+ */
+static int its_already_seen(const int *its, size_t itslen,
+		const struct itstree_node *itst)
+{
+	int cf[FPT_MAXLEN];
 
-	free(cf);
-	return ret;
+	sort_its(its, itslen, cf);
+	return search_its_private(itst, cf, itslen);
 }
 
 /**
@@ -153,36 +251,117 @@ static void update_seen_its(const int *its, size_t itslen,
 		size_t n30, size_t n50, size_t n70,
 		struct itstree_node *itst)
 {
-	int *cf = calloc(itslen, sizeof(cf[0]));
+	int cf[FPT_MAXLEN];
+
+	sort_its(its, itslen, cf);
+	record_its_private(itst, cf, itslen, n30, n50, n70);
+}
+
+/**
+ * Pack an itemset of candidates in a key: their positions in ic plus one,
+ * sorted, keybits bits each.
+ */
+static uint64_t its_key(const struct mining *m, const int *its, size_t itslen)
+{
+	int cf[FPT_MAXLEN], sl[FPT_MAXLEN];
+	uint64_t key = 0;
 	size_t i;
 
 	for (i = 0; i < itslen; i++)
-		cf[i] = its[i];
+		sl[i] = m->slots[its[i] - 1];
+	sort_its(sl, itslen, cf);
+	for (i = 0; i < itslen; i++)
+		key = (key << m->keybits) | (cf[i] + 1);
+	return key;
+}
 
-	qsort(cf, itslen, sizeof(cf[0]), int_cmp);
-	record_its_private(itst, cf, itslen, n30, n50, n70);
-	free(cf);
+static void init_seen(const struct mining *m, struct seen_its *s)
+{
+	s->set = m->keybits ? init_hashset() : NULL;
+	s->itst = m->keybits ? NULL : init_empty_itstree();
+}
+
+static void free_seen(struct seen_its *s)
+{
+	if (s->set)
+		free_hashset(s->set);
+	if (s->itst)
+		free_itstree(s->itst);
+}
+
+static int seen_before(const struct mining *m, const struct seen_its *s,
+		const int *its, size_t itslen)
+{
+	if (s->set)
+		return hashset_contains(s->set, its_key(m, its, itslen));
+	return its_already_seen(its, itslen, s->itst);
+}
+
+static void mark_seen(const struct mining *m, struct seen_its *s,
+		const int *its, size_t itslen)
+{
+	if (s->set)
+		hashset_insert(s->set, its_key(m, its, itslen));
+	else
+		update_seen_its(its, itslen, 0, 0, 0, s->itst);
 }
 
-static void generate_rules_from_itemset(const int *AB, size_t ab_length,
-		const struct fptree *fp, double *minc, double *maxc,
+/* add the itemsets of a loaded tree which could be generated again */
+static void seed_seen(const int *its, size_t itslen, void *arg)
+{
+	struct mining *m = arg;
+	size_t i;
+
+	/* without keys the run has its own tree, with no recall counts */
+	if (!m->seen.set) {
+		record_its_private(m->itst, its, itslen, 0, 0, 0);
+		return;
+	}
+	if (itslen < 2 || itslen > m->lmax)
+		return;
+	for (i = 0; i < itslen; i++)
+		if (its[i] <= 0 || (size_t)its[i] > m->fp->n ||
+				m->slots[its[i] - 1] < 0)
+			return;
+	hashset_insert(m->seen.set, its_key(m, its, itslen));
+}
+
+/**
+ * Spread the low bits of i over the bits set in mask.
+ */
+static ALWAYS_INLINE size_t deposit_bits(size_t i, size_t mask)
+{
+	size_t ret = 0, b;
+
+	for (b = 1; mask; b <<= 1, mask &= mask - 1)
+		if (i & b)
+			ret |= mask & -mask;
+	return ret;
+}
+
+/**
+ * Generate the rules of the itemset AB made of the leaf items in ab_mask,
+ * using the supports of all subsets of the leaf from sups.
+ */
+static ALWAYS_INLINE void generate_rules_from_itemset(const int *AB,
+		size_t ab_length,
+		size_t ab_mask, const int *sups, double *minc, double *maxc,
 		size_t *n30, size_t *n50, size_t *n70,
 		struct histogram *h)
 {
+#if PRINT_FINAL_RULES
 	int *A = calloc(ab_length, sizeof(A[0]));
-	size_t i, j, max, a_length;
+	size_t j, a_length;
+#endif
+	size_t i, max;
 	int sup_ab, sup_a;
 	double c;
 
+	(void)AB; /* used only if PRINT_FINAL_RULES */
 	max = (1 << ab_length) - 1;
-	sup_ab = fpt_itemset_count(fp, AB, ab_length);
+	sup_ab = sups[ab_mask];
 	for (i = 1; i < max; i++) {
-		a_length = 0;
-		for (j = 0; j < ab_length; j++)
-			if (i & (1 << j))
-				A[a_length++] = AB[j];
-
-		sup_a = fpt_itemset_count(fp, A, a_length);
+		sup_a = sups[deposit_bits(i, ab_mask)];
 		c = div_or_zero(sup_ab, sup_a);
 		if (c < *minc) *minc = c;
 		if (c > *maxc) *maxc = c;
@@ -192,21 +371,39 @@ static void generate_rules_from_itemset(const int *AB, size_t ab_length,
 		if (c > .7) *n70+=1;
 
 #if PRINT_FINAL_RULES
+		a_length = 0;
+		for (j = 0; j < ab_length; j++)
+			if (i & (1 << j))
+				A[a_length++] = AB[j];
 		print_this_rule(A, AB, a_length, ab_length, c);
 #endif
 	}
 
+#if PRINT_FINAL_RULES
 	free(A);
+#endif
 }
 
-static void generate_rules(const int *items, size_t lmax,
-		const struct fptree *fp,
-		double *minc, double *maxc, struct histogram *h,
-		struct itstree_node *itst)
+/**
+ * Rules of a leaf. Instantiated for each lmax below, so that the loops over
+ * the subsets of the leaf have constant bounds.
+ */
+#define RULES_FROM_ITEMSET(k) \
+	case k: \
+		generate_rules_from_itemset(AB, k, i, sups, &w->minc, \
+				&w->maxc, &n30, &n50, &n70, w->h); \
+		break
+
+static ALWAYS_INLINE void generate_rules(const struct mining *m,
+		struct miner *w, const int *items, const size_t lmax)
 {
-	size_t i, j, max=1<<lmax, ab_length, n30, n50, n70;
-	int *AB = calloc(lmax, sizeof(AB[0]));
+	size_t i, j, max = 1 << lmax, ab_length, n30, n50, n70;
+	int AB[FPT_MAXLEN], sups[1 << FPT_MAXLEN];
 
+	fpt_itemset_lattice(m->fp, items, lmax, sups);
+	/* the lattice is counted outside, only deduplication is serialized */
+	if (m->lock)
+		pthread_mutex_lock(m->lock);
 	for (i = 0; i < max; i++) {
 		ab_length = 0;
 		for (j = 0; j < lmax; j++)
@@ -214,21 +411,35 @@ static void generate_rules(const int *items, size_t lmax,
 				AB[ab_length++] = items[j];
 		if (ab_length < 2)
 			continue;
-		if (its_already_seen(AB, ab_length, itst))
+		/* one probe checks and marks a packed itemset */
+		if (m->seen.set) {
+			if (hashset_insert(m->seen.set,
+						its_key(m, AB, ab_length)))
+				continue;
+		} else if (its_already_seen(AB, ab_length, m->itst))
 			continue;
 		n30 = n50 = n70 = 0;
-		generate_rules_from_itemset(AB, ab_length, fp, minc, maxc,
-				&n30, &n50, &n70, h);
-		update_seen_its(AB, ab_length, n30, n50, n70, itst);
+		/* and so do the loops over the subsets of AB */
+		switch (ab_length) {
+		RULES_FROM_ITEMSET(2);
+		RULES_FROM_ITEMSET(3);
+		RULES_FROM_ITEMSET(4);
+		RULES_FROM_ITEMSET(5);
+		RULES_FROM_ITEMSET(6);
+		RULES_FROM_ITEMSET(7);
+		}
+		update_seen_its(AB, ab_length, n30, n50, n70, m->itst);
 	}
-
-	free(AB);
+	if (m->lock)
+		pthread_mutex_unlock(m->lock);
 }
+#undef RULES_FROM_ITEMSET
 
+/* stored inline in the reservoir, lmax is at most FPT_MAXLEN */
 struct reservoir_item {
-	int *items;
-	size_t sz;
+	int items[FPT_MAXLEN];
 	int support;
+	size_t sz;
 	double q;
 };
 
@@ -243,29 +454,6 @@ static void print_reservoir_item(const void *it)
 	printf("], s=%5d, q=%7.2lf", ri->support, ri->q);
 }
 
-static void *clone_reservoir_item(const void *it)
-{
-	struct reservoir_item *ret = calloc(1, sizeof(*ret));
-	const struct reservoir_item *ri = it;
-	size_t i;
-
-	ret->items = calloc(ri->sz, sizeof(ret->items[0]));
-	for (i = 0; i < ri->sz; i++)
-		ret->items[i] = ri->items[i];
-	ret->sz = ri->sz;
-	ret->support = ri->support;
-	ret->q = ri->q;
-
-	return ret;
-}
-
-static void free_reservoir_item(void *it)
-{
-	struct reservoir_item *ri = it;
-	free(ri->items);
-	free(ri);
-}
-
 static inline double quality_d(int x, int y, double c0)
 {
 	double q = -x + y / c0;
@@ -321,7 +509,7 @@ static inline double compute_quality(const struct fptree *fp, double c0,
 		const struct item_count *ic, size_t ix_item,
 		struct reservoir_item *rit, size_t lmax)
 {
-	int sup_ab = fpt_itemset_count(fp, rit->items, rit->sz);
+	int sup_ab = rit->support;
 	(void)lmax; /* used only if EM_FORCED_LAST */
 
 	/* select first item: use either real or noisy count */
@@ -344,6 +532,20 @@ static inline double compute_quality(const struct fptree *fp, double c0,
 	}
 }
 
+/**
+ * Copies the sorted ranks of a prefix to key, inserting r in order.
+ */
+static inline void insert_rank(const int *prefix, size_t len, int r, int *key)
+{
+	size_t i;
+
+	for (i = len; i > 0 && prefix[i - 1] > r; i--)
+		key[i] = prefix[i - 1];
+	key[i] = r;
+	while (i-- > 0)
+		key[i] = prefix[i];
+}
+
 static inline int generated_above(const int *celms, size_t level)
 {
 	size_t i;
@@ -354,67 +556,364 @@ static inline int generated_above(const int *celms, size_t level)
 	return 0;
 }
 
-static void mine_level(const struct fptree *fp, const struct item_count *ic,
-		size_t numits, size_t lmax, const int *celms, size_t level,
-		double c0, double *epss, size_t *spls, struct histogram *h,
-		double *minc, double *maxc, struct itstree_node *itst,
-		struct drand48_data *randbuffer)
+static void queue_branch(const struct mining *m, const int *path)
 {
-	struct reservoir_item *rit = calloc(1, sizeof(*rit));
-	const struct reservoir_item *crit;
-	struct reservoir_iterator *ri;
-	struct reservoir *r;
-	double eps_round;
+	struct branch *b = calloc(1, sizeof(*b));
 	size_t i;
 
-	r = init_reservoir(spls[level], print_reservoir_item,
-			clone_reservoir_item, free_reservoir_item);
-	eps_round = epss[level] / spls[level];
+	b->m = m;
+	for (i = 0; i < m->depth; i++)
+		b->path[i] = path[i];
+	pool_submit(m->pool, b);
+}
+
+/**
+ * Sample the extensions of celms at this level. The support of the candidate
+ * ic[i] is taken from sups[i] if sups is given. Last level candidates already
+ * generated are pruned using seen: the shared itemsets for a serial run, the
+ * itemsets of the same branch for a parallel one, so that the pruning does
+ * not depend on the order in which branches run. Instantiated for the last
+ * level of each lmax below, so that the loops over the items of a candidate
+ * have constant bounds.
+ */
+static ALWAYS_INLINE struct reservoir *sample_candidates(
+		const struct mining *m, const int *celms, const size_t level,
+		const int *sups, struct seen_its *seen, struct rng *rng)
+{
+	const struct item_count *ic = m->ic;
+	const struct fptree *fp = m->fp;
+	size_t lmax = m->lmax;
+	struct reservoir_item rit, *cands;
+	int prefix[FPT_MAXLEN], key[FPT_MAXLEN];
+	struct reservoir *r;
+	double eps_round, *logw;
+	size_t i, n = 0;
+
+	r = init_reservoir_fixed(m->spls[level], sizeof(rit),
+			print_reservoir_item);
+	eps_round = m->epss[level] / m->spls[level];
+	cands = malloc(m->numits * sizeof(cands[0]));
+	logw = malloc(m->numits * sizeof(logw[0]));
 
 	/* init common part of rit */
-	rit->sz = level + 1;
-	rit->items = calloc(rit->sz, sizeof(rit[0]));
-	for (i = 0; i < level; i++)
-		rit->items[i] = celms[i];
+	rit.sz = level + 1;
+	for (i = 0; i < level; i++) {
+		rit.items[i] = celms[i];
+		insert_rank(prefix, i, fpt_item_rank(fp, celms[i]), prefix);
+	}
 
 	/* generate last element */
-	for (i = 0; i < numits; i++) {
-		rit->items[level] = ic[i].value;
-		if (generated_above(rit->items, level))
+	for (i = 0; i < m->numits; i++) {
+		rit.items[level] = ic[i].value;
+		if (generated_above(rit.items, level))
 			continue;
 		if (level == lmax - 1 &&
-				its_already_seen(rit->items, lmax, itst))
+				seen_before(m, seen, rit.items, lmax))
 			continue;
 
-		rit->support = fpt_itemset_count(fp, rit->items, rit->sz);
-		rit->q = compute_quality(fp, c0, ic, i, rit, lmax);
-		add_to_reservoir_log(r, rit, eps_round * rit->q/2, randbuffer);
+		if (sups)
+			rit.support = sups[i];
+		else {
+			insert_rank(prefix, level, ic[i].rank, key);
+			rit.support = fpt_itemset_count_ranks(fp, key, rit.sz);
+		}
+		rit.q = compute_quality(fp, m->c0, ic, i, &rit, lmax);
+		cands[n] = rit;
+		logw[n++] = eps_round * rit.q/2;
 	}
-	free_reservoir_item(rit);
+
+	/* keys of all candidates at once */
+	add_batch_to_reservoir_log(r, cands, sizeof(cands[0]), logw, n, rng);
+	free(cands);
+	free(logw);
+	return r;
+}
+
+#define LMAX_KERNELS(n) \
+static void generate_rules_##n(const struct mining *m, struct miner *w, \
+		const int *items) \
+{ \
+	generate_rules(m, w, items, n); \
+} \
+static struct reservoir *sample_leaves_##n(const struct mining *m, \
+		const int *celms, const int *sups, struct seen_its *seen, \
+		struct rng *rng) \
+{ \
+	return sample_candidates(m, celms, n - 1, sups, seen, rng); \
+}
+LMAX_KERNELS(2)
+LMAX_KERNELS(3)
+LMAX_KERNELS(4)
+LMAX_KERNELS(5)
+LMAX_KERNELS(6)
+LMAX_KERNELS(7)
+#undef LMAX_KERNELS
+
+static const generate_rules_fun generate_rules_lmax[FPT_MAXLEN + 1] = {
+	NULL, NULL, generate_rules_2, generate_rules_3, generate_rules_4,
+	generate_rules_5, generate_rules_6, generate_rules_7
+};
+
+static const sample_leaves_fun sample_leaves_lmax[FPT_MAXLEN + 1] = {
+	NULL, NULL, sample_leaves_2, sample_leaves_3, sample_leaves_4,
+	sample_leaves_5, sample_leaves_6, sample_leaves_7
+};
+
+static struct reservoir *sample_level(const struct mining *m,
+		const int *celms, size_t level, const int *sups,
+		struct seen_its *seen, struct rng *rng)
+{
+	if (level == m->lmax - 1)
+		return m->sample_leaves(m, celms, sups, seen, rng);
+	return sample_candidates(m, celms, level, sups, seen, rng);
+}
+
+static void mine_leaves(const struct mining *m, struct miner *w,
+		struct reservoir *r, struct seen_its *seen)
+{
+	const struct reservoir_item *crit;
+	struct reservoir_iterator *ri;
 
 	ri = init_reservoir_iterator(r);
-	/* TODO: generate all subtrees after a level? */
-	if (level == lmax - 1)
-		while ((crit = next_item(ri)))
-			generate_rules(crit->items, lmax, fp, minc, maxc, h,
-					itst);
-	else while ((crit = next_item(ri)))
-		mine_level(fp, ic, numits, lmax, crit->items, level + 1, c0,
-				epss, spls, h, minc, maxc, itst, randbuffer);
+	while ((crit = next_item(ri))) {
+		m->generate_rules(m, w, crit->items);
+		if (seen != &m->seen)
+			mark_seen(m, seen, crit->items, m->lmax);
+	}
+	free_reservoir_iterator(ri);
+}
+
+/**
+ * Mine the subtree below celms, depth first. If given, base is the
+ * conditional pattern base of celms, giving the supports of all candidates
+ * in one scan. It is projected on each sampled extension and handed down.
+ */
+static void mine_level(const struct mining *m, struct miner *w,
+		const int *celms, size_t level, const struct fpt_base *base,
+		struct seen_its *seen, struct rng *rng)
+{
+	const struct reservoir_item *crit;
+	struct reservoir_iterator *ri;
+	struct fpt_base *child;
+	struct reservoir *r;
+	int *sups = NULL;
+
+	if (base) {
+		sups = calloc(m->numits, sizeof(sups[0]));
+		fpt_base_count(base, sups);
+	}
+	r = sample_level(m, celms, level, sups, seen, rng);
+	free(sups);
+	if (level == m->lmax - 1) {
+		mine_leaves(m, w, r, seen);
+		free_reservoir(r);
+		return;
+	}
+
+	ri = init_reservoir_iterator(r);
+	while ((crit = next_item(ri))) {
+		if (level + 1 == m->depth) {
+			queue_branch(m, crit->items);
+			continue;
+		}
+		child = NULL;
+		if (base)
+			child = fpt_base_project(base,
+					m->slots[crit->items[level] - 1]);
+		mine_level(m, w, crit->items, level + 1, child, seen,
+				rng);
+		if (child)
+			fpt_base_free(child);
+	}
 	free_reservoir_iterator(ri);
 	free_reservoir(r);
 }
 
-static void print_mining_scenario()
+static int frontier_key_cmp(const void *a, const void *b)
+{
+	const struct frontier_item *const *fa = a, *const *fb = b;
+	int c = memcmp((*fa)->key, (*fb)->key, sizeof((*fa)->key));
+
+	if (c)
+		return c;
+	return (*fa)->ix < (*fb)->ix ? -1 : (*fa)->ix > (*fb)->ix;
+}
+
+/**
+ * Supports of all the candidates of all the prefixes of a frontier. Prefixes
+ * made of the same items in a different order are counted only once.
+ */
+static void count_frontier(const struct mining *m, struct frontier_item *fr,
+		size_t nfr, size_t level, int *sups)
+{
+	struct frontier_item **sorted = calloc(nfr, sizeof(sorted[0]));
+	int *cands = calloc(m->numits, sizeof(cands[0]));
+	int *cix = calloc(m->numits, sizeof(cix[0]));
+	int *counts = calloc(m->numits, sizeof(counts[0]));
+	size_t i, j, k, nc;
+	int *row;
+
+	for (i = 0; i < nfr; i++) {
+		for (j = 0; j < level; j++)
+			insert_rank(fr[i].key, j, fpt_item_rank(m->fp,
+						fr[i].path[j]), fr[i].key);
+		fr[i].ix = i;
+		sorted[i] = &fr[i];
+	}
+	qsort(sorted, nfr, sizeof(sorted[0]), frontier_key_cmp);
+
+	for (i = 0; i < nfr; i = j) {
+		/* candidates not in the prefix */
+		for (k = 0, nc = 0; k < m->numits; k++) {
+			if (bsearch(&m->ic[k].rank, sorted[i]->key, level,
+					sizeof(int), int_cmp))
+				continue;
+			cands[nc] = m->ic[k].rank;
+			cix[nc++] = k;
+		}
+		fpt_itemset_count_batch(m->fp, sorted[i]->key, level, cands,
+				nc, counts);
+
+		row = sups + sorted[i]->ix * m->numits;
+		for (k = 0; k < nc; k++)
+			row[cix[k]] = counts[k];
+		for (j = i + 1; j < nfr && !memcmp(sorted[i]->key,
+					sorted[j]->key, sizeof(sorted[i]->key)); j++)
+			memcpy(sups + sorted[j]->ix * m->numits, row,
+					m->numits * sizeof(sups[0]));
+	}
+
+	free(counts);
+	free(cix);
+	free(cands);
+	free(sorted);
+}
+
+/**
+ * Mine the subtree below root, one level at a time. The candidates of all
+ * the prefixes of a level are counted before sampling any of them, and each
+ * prefix samples from its own random stream so that the result does not
+ * depend on the order of the frontier.
+ */
+static void mine_breadth_first(const struct mining *m, struct miner *w,
+		const int *root, size_t level, struct seen_its *seen)
+{
+	const struct reservoir_item *crit;
+	struct frontier_item *fr, *next;
+	struct rng rng;
+	struct reservoir_iterator *ri;
+	size_t nfr = 1, nnext, i, j;
+	struct reservoir *r;
+	int *sups;
+
+	fr = calloc(nfr, sizeof(fr[0]));
+	for (i = 0; i < level; i++)
+		fr[0].path[i] = root[i];
+
+	for (; level < m->lmax; level++) {
+		sups = calloc(nfr * m->numits, sizeof(sups[0]));
+		count_frontier(m, fr, nfr, level, sups);
+
+		next = calloc(nfr * m->spls[level], sizeof(next[0]));
+		nnext = 0;
+		for (i = 0; i < nfr; i++) {
+			init_rng_stream(m->seed, fr[i].path, level, m->engine,
+					&rng);
+			r = sample_level(m, fr[i].path, level,
+					sups + i * m->numits, seen, &rng);
+			if (level == m->lmax - 1) {
+				mine_leaves(m, w, r, seen);
+				free_reservoir(r);
+				continue;
+			}
+
+			ri = init_reservoir_iterator(r);
+			while ((crit = next_item(ri))) {
+				for (j = 0; j <= level; j++)
+					next[nnext].path[j] = crit->items[j];
+				nnext++;
+			}
+			free_reservoir_iterator(ri);
+			free_reservoir(r);
+		}
+
+		free(sups);
+		free(fr);
+		fr = next;
+		nfr = nnext;
+	}
+	free(fr);
+}
+
+static void run_branch(void *arg, size_t worker)
+{
+	struct branch *b = arg;
+	const struct mining *m = b->m;
+	struct fpt_base *base = NULL, *next;
+	struct rng rng;
+	struct seen_its seen;
+	size_t i;
+
+	init_seen(m, &seen);
+	if (m->bfs)
+		mine_breadth_first(m, &m->miners[worker], b->path, m->depth,
+				&seen);
+	else {
+		for (i = 0; m->base && i < m->depth; i++) {
+			next = fpt_base_project(base ? base : m->base,
+					m->slots[b->path[i] - 1]);
+			if (base)
+				fpt_base_free(base);
+			base = next;
+		}
+		init_rng_stream(m->seed, b->path, m->depth, m->engine,
+				&rng);
+		mine_level(m, &m->miners[worker], b->path, m->depth, base,
+				&seen, &rng);
+		if (base)
+			fpt_base_free(base);
+	}
+	free_seen(&seen);
+	free(b);
+}
+
+/**
+ * Mine the branches queued in the pool and merge the results of the workers
+ * into the first one.
+ */
+static void mine_branches(struct mining *m, size_t nthreads)
+{
+	pthread_mutex_t lock;
+	size_t i;
+
+	pthread_mutex_init(&lock, NULL);
+	m->lock = &lock;
+	fpt_share_cache(m->fp, 1);
+	pool_run(m->pool);
+	fpt_share_cache(m->fp, 0);
+	m->lock = NULL;
+	pthread_mutex_destroy(&lock);
+
+	for (i = 1; i < nthreads; i++) {
+		histogram_merge(m->miners[0].h, m->miners[i].h);
+		m->miners[0].minc = min(m->miners[0].minc, m->miners[i].minc);
+		m->miners[0].maxc = max(m->miners[0].maxc, m->miners[i].maxc);
+	}
+	fprintf(m->out, "Parallel mining: %lu branches at depth %lu, %lu threads, "
+			"%lu steals\n", pool_tasks(m->pool), m->depth,
+			nthreads, pool_steals(m->pool));
+}
+
+static void print_mining_scenario(FILE *out)
 {
 	size_t i;
 	enum quality_fun qf = QMETHOD;
 
-	printf("Methods used: ");
+	fprintf(out, "Methods used: ");
 #if EM_1ST_ITEM
-	printf("em ");
+	fprintf(out, "em ");
 #else
-	printf("noisy ");
+	fprintf(out, "noisy ");
 #endif
 
 	for (i = 0; i < 2; i++) {
@@ -422,18 +921,18 @@ static void print_mining_scenario()
 		if (i) qf = EM_QD;
 #endif
 #if !EM_LAST_ITEM
-		printf("m%c%c(", -EM_REDFUN(-'i',-'a'), EM_REDFUN('n', 'x'));
+		fprintf(out, "m%c%c(", -EM_REDFUN(-'i',-'a'), EM_REDFUN('n', 'x'));
 #endif
 		switch(qf) {
-		case EM_QD: printf("qd"); break;
-		case EM_QDELTA: printf("qdelta"); break;
-		default: printf("qsigma");
+		case EM_QD: fprintf(out, "qd"); break;
+		case EM_QDELTA: fprintf(out, "qdelta"); break;
+		default: fprintf(out, "qsigma");
 		}
 #if !EM_LAST_ITEM
-		printf(")");
+		fprintf(out, ")");
 #endif
-		if (i) printf("\n");
-		else printf(" ");
+		if (i) fprintf(out, "\n");
+		else fprintf(out, " ");
 	}
 }
 
@@ -441,18 +940,21 @@ static void print_mining_scenario()
  * Step 2 of mining, private.
  */
 static void mine_rules(const struct fptree *fp, const struct item_count *ic,
-		struct itstree_node *itst, double eps, double c0,
-		size_t numits, size_t lmax, size_t cspl,
+		const struct itstree_node *recall, struct itstree_node *itst,
+		double eps, double c0, size_t numits, size_t lmax, size_t cspl,
 		struct histogram *h, double *minc, double *maxc,
-		struct drand48_data *randbuffer)
+		size_t nthreads, size_t depth, int bfs, long int seed,
+		enum rng_engine engine, struct rng *rng, FILE *out)
 {
 	double *epsilons = calloc(lmax, sizeof(epsilons[0]));
 	size_t *spl = calloc(lmax, sizeof(spl[0]));
+	struct miner *miners;
+	struct mining m;
 	size_t i, f = 1;
 	double cf = 0;
 
-	printf("Mining with eps %lf, numitems=%lu\n", eps, numits);
-	print_mining_scenario();
+	fprintf(out, "Mining with eps %lf, numitems=%lu\n", eps, numits);
+	print_mining_scenario(out);
 
 #if !EM_1ST_ITEM
 	cf = 1;
@@ -468,17 +970,96 @@ static void mine_rules(const struct fptree *fp, const struct item_count *ic,
 #if !EM_1ST_ITEM
 	epsilons[0] = spl[0] * 2; /* use noisy count */
 #endif
-	printf("Total leaves %lu\n", f);
+	fprintf(out, "Total leaves %lu\n", f);
+
+	/* a serial run does not need the pool */
+	if (!depth)
+		nthreads = 1;
+	miners = calloc(nthreads, sizeof(miners[0]));
+	miners[0].h = h;
+	for (i = 0; i < nthreads; i++) {
+		if (i)
+			miners[i].h = init_histogram();
+		miners[i].minc = *minc;
+		miners[i].maxc = *maxc;
+	}
 
-	mine_level(fp, ic, numits, lmax, NULL, 0, c0, epsilons, spl, h,
-			minc, maxc, itst, randbuffer);
+	m.fp = fp;
+	m.ic = ic;
+	m.numits = numits;
+	m.lmax = lmax;
+	m.c0 = c0;
+	m.epss = epsilons;
+	m.spls = spl;
+	m.itst = itst;
+	m.lock = NULL;
+	m.depth = depth;
+	m.pool = depth ? init_pool(nthreads, run_branch) : NULL;
+	m.seed = seed;
+	m.engine = engine;
+	m.bfs = bfs;
+	m.miners = miners;
+	m.out = out;
+
+	m.slots = calloc(fp->n, sizeof(m.slots[0]));
+	for (i = 0; i < fp->n; i++)
+		m.slots[i] = -1;
+	for (i = 0; i < numits; i++)
+		m.slots[ic[i].value - 1] = i;
+
+	/* bases bypass the support cache and the tidsets, use them if enabled */
+	m.base = NULL;
+	if (!bfs && !fp->cache && !fp->vert) {
+		int *ranks = calloc(numits, sizeof(ranks[0]));
+
+		for (i = 0; i < numits; i++)
+			ranks[i] = ic[i].rank;
+		m.base = fpt_project(fp, ranks, numits);
+		free(ranks);
+	}
 
+	/* the tree of the run keeps the recall counts, and dedups if no keys */
+	m.generate_rules = generate_rules_lmax[lmax];
+	m.sample_leaves = sample_leaves_lmax[lmax];
+	m.keybits = 64 / lmax;
+	if (numits >= 1ULL << m.keybits)
+		m.keybits = 0;
+	m.seen.set = m.keybits ? init_hashset() : NULL;
+	m.seen.itst = itst;
+	itstree_for_each_private(recall, seed_seen, &m);
+
+	if (bfs && !depth)
+		mine_breadth_first(&m, &miners[0], NULL, 0, &m.seen);
+	else
+		mine_level(&m, &miners[0], NULL, 0, m.base, &m.seen,
+				rng);
+	if (m.pool) {
+		mine_branches(&m, nthreads);
+		free_pool(m.pool);
+	}
+	*minc = miners[0].minc;
+	*maxc = miners[0].maxc;
+
+	if (m.base)
+		fpt_base_free(m.base);
+	if (m.seen.set)
+		free_hashset(m.seen.set);
+	free(m.slots);
+
+	for (i = 1; i < nthreads; i++)
+		free_histogram(miners[i].h);
+	free(miners);
 	free(epsilons);
 	free(spl);
 }
 
-static void print_recall(const struct itstree_node *itst,
-		const struct histogram *h, size_t numits, size_t lmax)
+/**
+ * Recall of the itemsets generated in itst, with the real counts of recall.
+ * Private counts already in recall, loaded from a file, are added.
+ */
+static void print_recall(FILE *out, const struct itstree_node *recall,
+		const struct itstree_node *itst, const struct histogram *h,
+		size_t numits, size_t lmax)
 {
 	size_t n30, n50, n70, p30, p50, p70, N, T;
 	double r30, r50, r70;
@@ -486,17 +1067,18 @@ static void print_recall(const struct itstree_node *itst,
 	n30 = n50 = n70 = 0;
 	p30 = p50 = p70 = 0;
 
-	itstree_count_real(itst, &n30, &n50, &n70);
+	itstree_count_real(recall, &n30, &n50, &n70);
+	itstree_count_priv(recall, &p30, &p50, &p70);
 	itstree_count_priv(itst, &p30, &p50, &p70);
 
 	r30 = div_or_zero(p30, n30);
 	r50 = div_or_zero(p50, n50);
 	r70 = div_or_zero(p70, n70);
 
-	printf("Confthr: %14.2lf %14.2lf %14.2lf\n", .30, .50, .70);
-	printf("Private:   %12lu   %12lu   %12lu\n", p30, p50, p70);
-	printf("Real   :   %12lu   %12lu   %12lu\n", n30, n50, n70);
-	printf("Recall : %14.2lf %14.2lf %14.2lf\n", r30, r50, r70);
+	fprintf(out, "Confthr: %14.2lf %14.2lf %14.2lf\n", .30, .50, .70);
+	fprintf(out, "Private:   %12lu   %12lu   %12lu\n", p30, p50, p70);
+	fprintf(out, "Real   :   %12lu   %12lu   %12lu\n", n30, n50, n70);
+	fprintf(out, "Recall : %14.2lf %14.2lf %14.2lf\n", r30, r50, r70);
 
 	switch (lmax) {
 	case 3: N = numits * (numits -1) * (numits - 1); break;
@@ -517,50 +1099,55 @@ static void print_recall(const struct itstree_node *itst,
 	r30 = div_or_zero(p30, n30);
 	r50 = div_or_zero(p50, n50);
 	r70 = div_or_zero(p70, n70);
-	printf("estReal:   %12lu   %12lu   %12lu\n", n30, n50, n70);
-	printf("estRcll: %14.2lf %14.2lf %14.2lf\n", r30, r50, r70);
+	fprintf(out, "estReal:   %12lu   %12lu   %12lu\n", n30, n50, n70);
+	fprintf(out, "estRcll: %14.2lf %14.2lf %14.2lf\n", r30, r50, r70);
 }
 
-void dp2d(const struct fptree *fp, struct itstree_node *itst,
+void dp2d(const struct fptree *fp, const struct itstree_node *recall,
 		double eps, double eps_ratio1, double c0, size_t lmax,
-		size_t ni, size_t cspl, long int seed)
+		size_t ni, size_t cspl, long int seed, size_t nthreads,
+		size_t depth, int bfs, int compat, FILE *out)
 {
+	struct itstree_node *itst = init_empty_itstree();
 	struct item_count *ic = calloc(fp->n, sizeof(ic[0]));
 	double epsilon_step1 = eps * eps_ratio1;
 	struct histogram *h = init_histogram();
 	struct timeval starttime, endtime;
-	struct drand48_data randbuffer;
+	enum rng_engine engine = compat ? RNG_DRAND48 : RNG_XOSHIRO;
+	struct rng rng;
 	double minc, maxc, t1, t2;
 	size_t numits;
 
-	printf("eps=%lf, eps_step1=%lf, c0=%5.2lf, rmax=%lu\n",
+	fprintf(out, "eps=%lf, eps_step1=%lf, c0=%5.2lf, rmax=%lu\n",
 			eps, epsilon_step1, c0, lmax);
 
-	init_rng(seed, &randbuffer);
-	build_items_table(fp, ic, epsilon_step1, &randbuffer);
+	init_rng(seed, engine, &rng);
+	build_items_table(fp, ic, epsilon_step1, &rng, out);
 	minc = 1;
 	maxc = 0;
 	numits = min(ni, fp->n);
 	eps = eps - epsilon_step1;
 
 	gettimeofday(&starttime, NULL);
-	mine_rules(fp, ic, itst, eps, c0, numits, lmax, cspl, h, &minc, &maxc,
-			&randbuffer);
+	mine_rules(fp, ic, recall, itst, eps, c0, numits, lmax, cspl, h,
+			&minc, &maxc, nthreads, depth, bfs, seed, engine, &rng,
+			out);
 	gettimeofday(&endtime, NULL);
 	t1 = starttime.tv_sec + (0.0 + starttime.tv_usec) / MICROSECONDS;
 	t2 = endtime.tv_sec + (0.0 + endtime.tv_usec) / MICROSECONDS;
 
-	printf("Rules saved: %lu, minconf: %3.2lf, maxconf: %3.2lf\n",
+	fprintf(out, "Rules saved: %lu, minconf: %3.2lf, maxconf: %3.2lf\n",
 			histogram_get_all(h), minc, maxc);
-	printf("Total time: %5.2lf\n", t2 - t1);
-	printf("%ld %ld %ld %ld\n", starttime.tv_sec, starttime.tv_usec,
+	fprintf(out, "Total time: %5.2lf\n", t2 - t1);
+	fprintf(out, "%ld %ld %ld %ld\n", starttime.tv_sec, starttime.tv_usec,
 			endtime.tv_sec, endtime.tv_usec);
 
-	printf("Final histogram:\n");
-	histogram_dump(stdout, h, 1, "\t");
+	fprintf(out, "Final histogram:\n");
+	histogram_dump(out, h, 1, "\t");
 
-	print_recall(itst, h, numits, lmax);
+	print_recall(out, recall, itst, h, numits, lmax);
 
+	free_itstree(itst);
 	free_histogram(h);
 	free(ic);
 }
@@ -4,11 +4,33 @@
 #ifndef _DP2D_H
 #define _DP2D_H
 
+#include <stdio.h>
+
 struct fptree;
 struct itstree_node;
 
-void dp2d(const struct fptree *fp, struct itstree_node *itst,
+/**
+ * Mine the rules of fp. With depth > 0, the branches of the sampling tree
+ * starting at that level are mined by nthreads threads, each branch drawing
+ * from its own random stream derived from seed and the path to it: the
+ * results depend on depth but not on nthreads. Each branch prunes its last
+ * level candidates against its own itemsets only, not against those of the
+ * recall tree or of the other branches, so depth changes the rules sampled,
+ * not just how they are scheduled: a run with depth > 0 differs from a
+ * serial one even on one thread. With bfs, the tree (or each branch) is
+ * mined level by level, counting all candidates of a level in batches before
+ * sampling from them. Otherwise, unless fp has a support cache or tidsets,
+ * the supports of the candidates are counted on the conditional pattern
+ * bases of their prefixes. With compat, random numbers come from drand48_r
+ * instead of xoshiro256**, reproducing the output of older runs.
+ *
+ * The report is written to out. The recall tree is only read: the itemsets
+ * generated are kept in a tree private to the run, so that several runs can
+ * share the same fp-tree (with fpt_share_cache) and recall tree.
+ */
+void dp2d(const struct fptree *fp, const struct itstree_node *recall,
 		double eps, double eps_ratio1, double c0, size_t lmax,
-		size_t ni, size_t cspl, long int seed);
+		size_t ni, size_t cspl, long int seed, size_t nthreads,
+		size_t depth, int bfs, int compat, FILE *out);
 
 #endif
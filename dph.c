@@ -5,10 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "dp2d.h"
 #include "fp.h"
+#include "globals.h"
 #include "itstree.h"
+#include "pool.h"
 
 /* Command line arguments */
 static struct {
@@ -30,16 +34,69 @@ static struct {
 	size_t cspl;
 	/* random seed */
 	long int seed;
+	/* number of threads used to parse the transactions */
+	size_t threads;
+	/* allocate tree nodes from transparent huge pages */
+	int hugepages;
+	/* memory for the support cache, in MB, 0 to disable it */
+	size_t cache_mb;
+	/* count supports of the top NI items on tidsets */
+	int vertical;
+	/* filename to save the fp-tree snapshot to, if any */
+	char *sfname;
+	/* filename of transactions appended to the tree, if any */
+	char *afname;
+	/* fraction of items changing rank before the tree is rebuilt */
+	double drift;
+	/* mine the last transactions of a stream, 0 for a static file */
+	size_t window;
+	/* expire transactions older than this many seconds, 0 for never */
+	long max_age;
+	/* transactions read between two mining runs on the window */
+	size_t refresh;
+	/* number of threads used for mining */
+	size_t mine_threads;
+	/*
+	 * level of the sampling tree from which branches are mined apart, in
+	 * parallel; changes the rules sampled, not only their scheduling
+	 */
+	size_t depth;
+	/* mine the sampling tree breadth first */
+	int bfs;
+	/* draw random numbers with drand48_r, as older versions did */
+	int compat;
+	/* filename of the jobs run on the same trees, if any */
+	char *jfname;
 } args;
 
+/* one line of a job file, a run with its own report */
+struct job {
+	char *ofname;
+	double eps;
+	double er1;
+	double c0;
+	size_t lmax;
+	size_t ni;
+	size_t cspl;
+	long int seed;
+	const struct fptree *fp;
+	/* recall tree for lmax and ni, loaded by the first job using it */
+	struct itstree_node *itst;
+	int loaded;
+};
+
 static void usage(const char *prg)
 {
-	fprintf(stderr, "Usage: %s TFILE IFILE EPS EPS_RATIO_1 C0 RLEN NI BF [SEED]\n", prg);
+	fprintf(stderr, "Usage: %s [-j THREADS] [-m CACHE_MB] [-H] [-v] [-s SNAPSHOT] [-a APPEND_FILE] [-d DRIFT] [-w WINDOW [-T SECONDS] [-r REFRESH]] [-D DEPTH [-p THREADS]] [-B] [-R] TFILE IFILE EPS EPS_RATIO_1 C0 RLEN NI BF [SEED]\n"
+			"       %s [OPTIONS] -J JOBFILE TFILE IFILE\n"
+			"Each line of JOBFILE is OUTFILE EPS EPS_RATIO_1 C0 RLEN NI BF SEED, the recall of a job is read from IFILE_RLEN_NI\n"
+			"CACHE_MB defaults to 64 with -B or -v and to 0 otherwise, as depth first mining then counts on pattern bases\n", prg, prg);
 	exit(EXIT_FAILURE);
 }
 
 static void parse_arguments(int argc, char **argv)
 {
+	const char *prg = argv[0];
 	int i;
 
 	printf("Called with: argc=%d\n", argc);
@@ -47,51 +104,386 @@ static void parse_arguments(int argc, char **argv)
 		printf("%s ", argv[i]);
 	printf("\n");
 
+	args.threads = 1;
+	args.hugepages = 0;
+	args.cache_mb = (size_t)-1;
+	args.vertical = 0;
+	args.sfname = NULL;
+	args.afname = NULL;
+	args.drift = 0.05;
+	args.window = 0;
+	args.max_age = 0;
+	args.refresh = 0;
+	args.mine_threads = 1;
+	args.depth = (size_t)-1;
+	args.bfs = 0;
+	args.compat = 0;
+	args.jfname = NULL;
+	while ((i = getopt(argc, argv, "j:m:vs:a:d:w:T:r:p:D:BRJ:H")) != -1)
+		switch (i) {
+		case 'j':
+			if (sscanf(optarg, "%lu", &args.threads) != 1 || !args.threads)
+				usage(prg);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%lu", &args.cache_mb) != 1)
+				usage(prg);
+			break;
+		case 'v':
+			args.vertical = 1;
+			break;
+		case 's':
+			args.sfname = strdup(optarg);
+			break;
+		case 'a':
+			args.afname = strdup(optarg);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%lf", &args.drift) != 1 || args.drift < 0)
+				usage(prg);
+			break;
+		case 'w':
+			if (sscanf(optarg, "%lu", &args.window) != 1 || !args.window)
+				usage(prg);
+			break;
+		case 'T':
+			if (sscanf(optarg, "%ld", &args.max_age) != 1 || args.max_age < 0)
+				usage(prg);
+			break;
+		case 'r':
+			if (sscanf(optarg, "%lu", &args.refresh) != 1 || !args.refresh)
+				usage(prg);
+			break;
+		case 'p':
+			if (sscanf(optarg, "%lu", &args.mine_threads) != 1 || !args.mine_threads)
+				usage(prg);
+			break;
+		case 'D':
+			if (sscanf(optarg, "%lu", &args.depth) != 1)
+				usage(prg);
+			break;
+		case 'B':
+			args.bfs = 1;
+			break;
+		case 'R':
+			args.compat = 1;
+			break;
+		case 'J':
+			args.jfname = strdup(optarg);
+			break;
+		case 'H':
+			args.hugepages = 1;
+			break;
+		default:
+			usage(prg);
+		}
+	/* the window tree is never frozen */
+	if (args.window && (args.vertical || args.sfname || args.afname))
+		usage(prg);
+	if ((args.max_age || args.refresh) && !args.window)
+		usage(prg);
+	if (args.window && args.jfname)
+		usage(prg);
+	if (!args.refresh)
+		args.refresh = args.window;
+	/*
+	 * Depth first mining counts on conditional pattern bases unless a
+	 * cache or tidsets are asked for, the cache is only on by default
+	 * when supports go through fpt_itemset_count.
+	 */
+	if (args.cache_mb == (size_t)-1)
+		args.cache_mb = args.bfs || args.vertical ? 64 : 0;
+	/* positional arguments start at argv[1] */
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	/* the jobs are mined in parallel, each one serially by default */
+	if (args.jfname) {
+		if (argc != 3)
+			usage(prg);
+		args.tfname = strdup(argv[1]);
+		args.rfname = strdup(argv[2]);
+		if (args.depth == (size_t)-1)
+			args.depth = 0;
+		return;
+	}
+
 	if (argc < 9 || argc > 10)
-		usage(argv[0]);
+		usage(prg);
 	args.tfname = strdup(argv[1]);
 	args.rfname = strdup(argv[2]);
 	if (sscanf(argv[3], "%lf", &args.eps) != 1 || args.eps < 0)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[4], "%lf", &args.er1) != 1 || args.er1 < 0 || args.er1 >= 1)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[5], "%lf", &args.c0) != 1 || args.c0 < 0 || args.c0 >= 1)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[6], "%lu", &args.lmax) != 1 || args.lmax < 2 || args.lmax > 7)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[7], "%lu", &args.ni) != 1)
-		usage(argv[0]);
+		usage(prg);
 	if (sscanf(argv[8], "%lu", &args.cspl) != 1)
-		usage(argv[0]);
+		usage(prg);
 	if (argc == 10) {
 		if (sscanf(argv[9], "%ld", &args.seed) != 1)
-			usage(argv[0]);
+			usage(prg);
 	} else
 		args.seed = 42;
+
+	/* results depend on the depth only, so threads need an explicit one */
+	if (args.depth == (size_t)-1) {
+		if (args.mine_threads > 1)
+			usage(prg);
+		args.depth = 0;
+	}
+	if (args.depth >= args.lmax)
+		usage(prg);
 }
 
-int main(int argc, char **argv)
+static void mine(const struct fptree *fp)
 {
 	struct itstree_node *itst;
-	struct fptree fp;
 
-	parse_arguments(argc, argv);
-
-	fpt_read_from_file(args.tfname, &fp);
 	printf("fp-tree: items: %lu, transactions: %lu, nodes: %d, depth: %d\n",
-			fp.n, fp.t, fpt_nodes(&fp), fpt_height(&fp));
+			fp->n, fp->t, fpt_nodes(fp), fpt_height(fp));
 
 	if (!strncmp(args.rfname, "-", 1))
 		itst = init_empty_itstree();
 	else
 		itst = load_its(args.rfname, args.lmax, args.ni);
-	dp2d(&fp, itst, args.eps, args.er1, args.c0, args.lmax,
-			args.ni, args.cspl, args.seed);
+	dp2d(fp, itst, args.eps, args.er1, args.c0, args.lmax,
+			args.ni, args.cspl, args.seed, args.mine_threads,
+			args.depth, args.bfs, args.compat, stdout);
+	fpt_print_cache_stats(fp);
 
 	free_itstree(itst);
+}
+
+static void run_job(void *arg, size_t worker)
+{
+	struct job *j = arg;
+	FILE *f;
+
+	(void)worker;
+	f = fopen(j->ofname, "w");
+	if (!f)
+		die("Unable to write job output to %s", j->ofname);
+	dp2d(j->fp, j->itst, j->eps, j->er1, j->c0, j->lmax, j->ni, j->cspl,
+			j->seed, 1, args.depth, args.bfs, args.compat, f);
+	fclose(f);
+	printf("Job %s done\n", j->ofname);
+}
+
+/**
+ * Parse the job file, before building the tree to report errors early.
+ * args.ni is raised to the largest NI, for the tidsets of -v.
+ */
+static struct job *read_jobs(size_t *n)
+{
+	size_t cap = 0, sp = 0, line = 0;
+	struct job *jobs = NULL, *j;
+	char *buf = NULL, *p;
+	FILE *f;
+
+	f = fopen(args.jfname, "r");
+	if (!f)
+		die("Invalid job filename %s", args.jfname);
+
+	*n = 0;
+	while (getline(&buf, &cap, f) > 0) {
+		line++;
+		for (p = buf; *p == ' ' || *p == '\t'; p++);
+		if (*p == '\n' || *p == '\0' || *p == '#')
+			continue;
+		if (*n == sp) {
+			sp = sp ? 2 * sp : 16;
+			jobs = realloc(jobs, sp * sizeof(jobs[0]));
+		}
+		j = &jobs[*n];
+		if (sscanf(p, "%ms %lf %lf %lf %lu %lu %lu %ld", &j->ofname,
+					&j->eps, &j->er1, &j->c0, &j->lmax,
+					&j->ni, &j->cspl, &j->seed) != 8 ||
+				j->eps < 0 || j->er1 < 0 || j->er1 >= 1 ||
+				j->c0 < 0 || j->c0 >= 1 || j->lmax < 2 ||
+				j->lmax > 7 || args.depth >= j->lmax)
+			die("Invalid job at %s:%lu", args.jfname, line);
+		args.ni = max(args.ni, j->ni);
+		(*n)++;
+	}
+
+	fclose(f);
+	free(buf);
+	return jobs;
+}
+
+/* recall trees, each loaded once and shared by the jobs with its settings */
+static void load_recall(struct job *jobs, size_t n)
+{
+	char *fname;
+	size_t i, k;
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < i; k++)
+			if (jobs[k].lmax == jobs[i].lmax &&
+					jobs[k].ni == jobs[i].ni)
+				break;
+		jobs[i].loaded = k == i;
+		if (k < i) {
+			jobs[i].itst = jobs[k].itst;
+			continue;
+		}
+		if (!strncmp(args.rfname, "-", 1)) {
+			jobs[i].itst = init_empty_itstree();
+			continue;
+		}
+		/* the name save_its gives to the tree */
+		fname = malloc(strlen(args.rfname) + 48);
+		sprintf(fname, "%s_%lu_%lu", args.rfname, jobs[i].lmax,
+				jobs[i].ni);
+		jobs[i].itst = load_its(fname, jobs[i].lmax, jobs[i].ni);
+		free(fname);
+	}
+}
+
+/**
+ * Run all the jobs on the same trees, args.mine_threads at a time. Only the
+ * support cache of fp is written by several jobs, it is locked meanwhile.
+ */
+static void mine_batch(const struct fptree *fp, struct job *jobs, size_t n)
+{
+	struct pool *pool;
+	size_t i;
+
+	printf("fp-tree: items: %lu, transactions: %lu, nodes: %d, depth: %d\n",
+			fp->n, fp->t, fpt_nodes(fp), fpt_height(fp));
+
+	for (i = 0; i < n; i++)
+		jobs[i].fp = fp;
+	load_recall(jobs, n);
+	printf("Running %lu jobs on %lu threads\n", n, args.mine_threads);
+
+	pool = init_pool(args.mine_threads, run_job);
+	for (i = 0; i < n; i++)
+		pool_submit(pool, &jobs[i]);
+	fpt_share_cache(fp, 1);
+	pool_run(pool);
+	fpt_share_cache(fp, 0);
+	free_pool(pool);
+	fpt_print_cache_stats(fp);
+
+	for (i = 0; i < n; i++)
+		if (jobs[i].loaded)
+			free_itstree(jobs[i].itst);
+}
+
+static void mine_window(struct fpt_window *w, size_t seen)
+{
+	printf("Window: %lu transactions, %lu read\n", w->fp.t, seen);
+	fpt_rebalance(&w->fp, args.drift);
+	fpt_enable_cache(&w->fp, args.cache_mb << 20);
+	mine(&w->fp);
+}
+
+/* items of a transaction line, parsed as for transaction files */
+static int parse_transaction(const char *p, int **items, size_t *sz)
+{
+	int len = 0, x;
+
+	while (*p) {
+		if ((unsigned)(*p - '0') >= 10) {
+			p++;
+			continue;
+		}
+		for (x = 0; (unsigned)(*p - '0') < 10; p++)
+			x = x * 10 + (*p - '0');
+		if ((size_t)len == *sz) {
+			*sz = *sz ? 2 * *sz : 16;
+			*items = realloc(*items, *sz * sizeof((*items)[0]));
+		}
+		(*items)[len++] = x;
+	}
+
+	return len;
+}
+
+/**
+ * Read transactions one line at a time, keeping the last ones in a window
+ * and mining it every args.refresh transactions and at the end.
+ */
+static void mine_stream(void)
+{
+	size_t cap = 0, sz = 0, seen = 0;
+	struct fpt_window w;
+	int *items = NULL, len;
+	char *line = NULL;
+	long now;
+	FILE *f;
+
+	f = strcmp(args.tfname, "-") ? fopen(args.tfname, "r") : stdin;
+	if (!f)
+		die("Invalid transaction filename %s", args.tfname);
+
+	fpt_window_init(&w, args.window);
+	while (getline(&line, &cap, f) > 0) {
+		len = parse_transaction(line, &items, &sz);
+		now = time(NULL);
+		fpt_window_add(&w, items, len, now);
+		if (args.max_age)
+			fpt_window_expire(&w, now - args.max_age);
+		if (++seen % args.refresh == 0)
+			mine_window(&w, seen);
+	}
+	if (seen % args.refresh)
+		mine_window(&w, seen);
+
+	if (f != stdin)
+		fclose(f);
+	fpt_window_cleanup(&w);
+	free(items);
+	free(line);
+}
+
+int main(int argc, char **argv)
+{
+	struct job *jobs = NULL;
+	struct fptree fp;
+	size_t njobs = 0, i;
+
+	parse_arguments(argc, argv);
+	if (args.hugepages)
+		fpt_use_hugepages(1);
+	if (args.jfname)
+		jobs = read_jobs(&njobs);
+
+	if (args.window) {
+		mine_stream();
+		goto end;
+	}
+
+	fpt_read_from_file(args.tfname, args.threads, &fp);
+	if (args.afname)
+		fpt_append_file(&fp, args.afname, args.threads, args.drift);
+	fpt_freeze(&fp);
+	if (args.sfname)
+		fpt_save_snapshot(&fp, args.sfname);
+	fpt_enable_cache(&fp, args.cache_mb << 20);
+	if (args.vertical)
+		fpt_build_vertical(&fp, args.ni);
+	if (args.jfname)
+		mine_batch(&fp, jobs, njobs);
+	else
+		mine(&fp);
 	fpt_cleanup(&fp);
+
+	for (i = 0; i < njobs; i++)
+		free(jobs[i].ofname);
+	free(jobs);
+end:
 	free(args.tfname);
+	free(args.sfname);
+	free(args.afname);
 	free(args.rfname);
+	free(args.jfname);
 
 	return 0;
 }
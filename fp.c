@@ -1,11 +1,40 @@
-#include <ctype.h>
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <gmp.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "fp.h"
 #include "globals.h"
+#include "supcache.h"
+#include "tdb.h"
+#include "vertical.h"
+
+#define MB (1024.0 * 1024.0)
+#define MICROSECONDS 1000000L
+
+/* back the node arena with transparent huge pages, by default */
+#ifndef FP_HUGEPAGES
+#define FP_HUGEPAGES 0
+#endif
+/* arenas of the trees built from now on use huge pages */
+static int hugepages = FP_HUGEPAGES;
+/* index children by value when a node has more than this many */
+#ifndef FP_HASH_FANOUT
+#define FP_HASH_FANOUT 16
+#endif
+/* a tree is built in shards only if each gets this many transactions */
+#ifndef FP_SHARD_MIN
+#define FP_SHARD_MIN 65536
+#endif
 
 struct fptree_node {
 	/* item value */
@@ -14,14 +43,18 @@ struct fptree_node {
 	int cnt;
 	/* next node in item-chain in tree */
 	struct fptree_node *next;
-	/* number of children nodes */
-	int num_children;
-	/* vector of children nodes */
+	/*
+	 * vector of children nodes, allocated in the tree arena, in insertion
+	 * order; above FP_HASH_FANOUT it is followed by a hash index of
+	 * 2 * sz_children slots
+	 */
 	struct fptree_node **children;
-	/* size of said vector */
-	int sz_children;
 	/* parent in tree */
 	struct fptree_node *parent;
+	/* number of children nodes */
+	int num_children;
+	/* size of said vector (a power of 2, 0 for leaves) */
+	int sz_children;
 };
 
 struct table {
@@ -37,181 +70,375 @@ struct table {
 	size_t rpi;
 };
 
-/* sort table entries in descending order */
-static int fptable_cmp(const void *a, const void *b)
+/**
+ * Read-only flattened tree, one array per node field. The root is node 0 and
+ * the nodes of the item with rank r occupy indices chain[r] to
+ * chain[r + 1] - 1, in depth-first order, so parents always come before
+ * their children.
+ */
+struct fpt_flat {
+	/* number of nodes, including the root */
+	uint32_t nodes;
+	/* rank of the item of each node */
+	int32_t *rank;
+	/* count of item on the path to each node */
+	int32_t *cnt;
+	/* index of parent node, 0 for the root */
+	uint32_t *parent;
+	/* number of items on the path from the root to each node */
+	uint32_t *depth;
+	/* start of each item-chain, n + 1 entries */
+	uint32_t *chain;
+	/* snapshot mapping backing the arrays, if any */
+	void *map;
+	/* size of the mapping */
+	size_t bytes;
+};
+
+/* header table is a direct copy of the ranked item table */
+static void build_table(const struct tdb *db, struct fptree *fp)
 {
-	const struct table *ta = a, *tb = b;
-	return tb->cnt - ta->cnt;
+	size_t i;
+
+	fp->n = db->n;
+	fp->t = db->t;
+
+	fp->table = calloc(fp->n, sizeof(fp->table[0]));
+	for (i = 0; i < fp->n; i++) {
+		fp->table[i].val = db->order[i];
+		fp->table[i].cnt = db->supports[i];
+		fp->table[i].fst = NULL;
+		fp->table[i].lst = NULL;
+	}
+
+	for (i = 0; i < fp->n; i++)
+		fp->table[db->order[i] - 1].rpi = i;
 }
 
-#define LINELENGTH 4096
-#define INITIAL_SIZE 100
+static void fpt_add_transaction(const int *t, int sz, int cnt,
+		struct fptree_node *fpn, struct table *tb, struct arena *a);
+static void build_tree(const struct tdb *db, const struct fptree *fp)
+{
+	size_t t;
+
+	for (t = 0; t < db->t; t++)
+		fpt_add_transaction(db->items + db->offsets[t],
+				db->offsets[t + 1] - db->offsets[t], 1,
+				fp->tree, fp->table, fp->arena);
+}
 
-static void single_item_stat(FILE *f, struct fptree *fp)
+static struct fptree_node *fpt_node_new(struct arena *a)
 {
-	size_t x, sa = INITIAL_SIZE, *xs, i;
-	char line[LINELENGTH];
+	struct fptree_node *n = arena_alloc(a, sizeof(*n));
 
-	fp->t = fp->n = 0;
+	/* nodes released by a window are reused, leaves have no children */
+	memset(n, 0, sizeof(*n));
+	return n;
+}
 
-	while (fgets(line, LINELENGTH, f))
-		if (line[strlen(line) - 1] == '\n')
-			fp->t++;
+/* number of slots of the children vector, including the hash index */
+static inline int fpt_children_slots(int sz)
+{
+	return sz > FP_HASH_FANOUT ? 3 * sz : sz;
+}
 
-	fseek(f, 0, SEEK_SET);
-	xs = calloc(sa, sizeof(xs[0]));
+static inline uint32_t fpt_child_hash(int val, int sz)
+{
+	/* the index has 2 * sz slots */
+	return ((uint32_t)val * 0x9e3779b1u) >> (31 - __builtin_ctz(sz));
+}
 
-	while (fscanf(f, "%lu", &x) == 1) {
-		if ((size_t)x > fp->n)
-			fp->n = x;
-		if (x >= sa) {
-			i = sa;
-			while (x >= sa)
-				sa *= 2;
-			xs = realloc(xs, sa * sizeof(xs[0]));
-			for (; i < sa; i++)
-				xs[i] = 0;
-		}
-		xs[x]++;
-	}
+static void fpt_index_child(struct fptree_node *fpn, struct fptree_node *n)
+{
+	struct fptree_node **index = fpn->children + fpn->sz_children;
+	uint32_t mask = 2 * fpn->sz_children - 1;
+	uint32_t h = fpt_child_hash(n->val, fpn->sz_children);
 
-	fp->table = calloc(fp->n, sizeof(fp->table[0]));
-	for (i = 0; i < fp->n; i++) {
-		fp->table[i].val = i + 1;
-		fp->table[i].cnt = xs[i + 1];
-		fp->table[i].fst = NULL;
-		fp->table[i].lst = NULL;
-		fp->table[i].rpi = i;
-	}
-	qsort(fp->table, fp->n, sizeof(fp->table[0]), fptable_cmp);
+	while (index[h])
+		h = (h + 1) & mask;
+	index[h] = n;
+}
 
-	for (x = 0; x < fp->n; x++) {
-		i = fp->table[x].val - 1;
-		if (i < fp->n) /* check to be inside table */
-			fp->table[i].rpi = x;
-	}
+/* build the hash index from scratch, reused memory is not zeroed */
+static void fpt_reindex_children(struct fptree_node *fpn)
+{
+	int i;
 
-	free(xs);
-	fseek(f, 0, SEEK_SET);
+	memset(fpn->children + fpn->sz_children, 0,
+			2 * fpn->sz_children * sizeof(fpn->children[0]));
+	for (i = 0; i < fpn->num_children; i++)
+		fpt_index_child(fpn, fpn->children[i]);
 }
 
-static void fpt_add_transaction(const int *t, int c, int sz,
-		struct fptree_node *fpn, struct table *tb);
-static void read_transactions(FILE *f, const struct fptree *fp)
+static struct fptree_node *fpt_find_child(const struct fptree_node *fpn,
+		int val)
 {
-	int l, i, save = 0, newt, *items, isz = 0, isp = INITIAL_SIZE;
-	char line[LINELENGTH], *p, *q;
+	struct fptree_node **index = fpn->children + fpn->sz_children;
+	uint32_t mask = 2 * fpn->sz_children - 1, h;
+	int i;
 
-	items = calloc(isp, sizeof(items[0]));
+	if (fpn->sz_children <= FP_HASH_FANOUT) {
+		for (i = 0; i < fpn->num_children; i++)
+			if (fpn->children[i]->val == val)
+				return fpn->children[i];
+		return NULL;
+	}
 
-	while (fgets(line, LINELENGTH, f)) {
-		l = strlen(line) - 1;
-		newt = line[l] == '\n';
-		p = line;
+	for (h = fpt_child_hash(val, fpn->sz_children); index[h];
+			h = (h + 1) & mask)
+		if (index[h]->val == val)
+			return index[h];
+	return NULL;
+}
 
-		/* reform number split between reads */
-		if (save) {
-			while (isdigit(*p)) {
-				save = save * 10 + (*p - '0');
-				p++;
-			}
-			if (isz >= isp) {
-				isp *= 2;
-				items = realloc(items, isp * sizeof(items[0]));
-			}
-			items[isz++] = save;
-			save = 0;
-		}
+static void fpt_node_add_child(struct fptree_node *fpn,
+		struct fptree_node *n, struct arena *a)
+{
+	struct fptree_node **children;
+	int sz;
 
-		/* see if another number is split */
-		if (isdigit(line[l])) {
-			q = strrchr(line, ' ');
-			if (q) {
-				save = strtol(q, NULL, 0);
-				*q = 0; /* remove last number */
-			}
+	if (fpn->num_children == fpn->sz_children) {
+		sz = fpn->sz_children ? 2 * fpn->sz_children : 1;
+		children = arena_alloc(a, fpt_children_slots(sz) *
+				sizeof(children[0]));
+		if (fpn->num_children) {
+			memcpy(children, fpn->children,
+				fpn->num_children * sizeof(children[0]));
+			arena_release(a, fpn->children,
+				fpt_children_slots(fpn->sz_children) *
+				sizeof(children[0]));
 		}
+		fpn->children = children;
+		fpn->sz_children = sz;
+		if (sz > FP_HASH_FANOUT)
+			fpt_reindex_children(fpn);
+	}
+	fpn->children[fpn->num_children++] = n;
+	if (fpn->sz_children > FP_HASH_FANOUT)
+		fpt_index_child(fpn, n);
+}
 
-		while ((i = strtol(p, &q, 10))) {
-			if (isz >= isp) {
-				isp *= 2;
-				items = realloc(items, isp * sizeof(items[0]));
-			}
-			items[isz++] = i;
-			p = q;
-		}
+/* create a child of fpn for the item of the given rank */
+static struct fptree_node *fpt_new_child(struct fptree_node *fpn, int rank,
+		int cnt, struct table *tb, struct arena *a)
+{
+	struct fptree_node *n = fpt_node_new(a);
 
-		if (newt) {
-			for (i = 0; i < isz; i++)
-				items[i] = fp->table[items[i]-1].rpi;
-			qsort(items, isz, sizeof(items[0]), int_cmp);
-			for (i = 0; i < isz; i++)
-				items[i] = fp->table[items[i]].val;
-			fpt_add_transaction(items, 0, isz, fp->tree, fp->table);
-			isz = 0;
-		}
+	n->val = tb[rank].val;
+	n->cnt = cnt;
+	if (tb[rank].fst == NULL)
+		tb[rank].fst = tb[rank].lst = n;
+	else {
+		tb[rank].lst->next = n;
+		tb[rank].lst = n;
 	}
+	fpt_node_add_child(fpn, n, a);
+	n->parent = fpn;
+	return n;
+}
 
-	free(items);
+/**
+ * Add cnt occurrences of a transaction. t holds the ranks of its items, in
+ * increasing order.
+ */
+static void fpt_add_transaction(const int *t, int sz, int cnt,
+		struct fptree_node *fpn, struct table *tb, struct arena *a)
+{
+	struct fptree_node *n;
+	int c;
+
+	for (c = 0; c < sz; c++, fpn = n) {
+		n = fpt_find_child(fpn, tb[t[c]].val);
+		if (n)
+			n->cnt += cnt;
+		else
+			n = fpt_new_child(fpn, t[c], cnt, tb, a);
+	}
 }
 
-#undef LINELENGTH
-#undef INITIAL_SIZE
-#define INITIAL_SIZE 10
+/**
+ * A shard of the transactions, built into a private tree with the global
+ * item order, then merged with the other shards.
+ */
+struct fpt_shard {
+	const struct tdb *db;
+	/* transactions of the shard */
+	size_t from, to;
+	/* private tree, item-chains and node storage */
+	struct fptree_node *tree;
+	struct table *table;
+	struct arena *arena;
+	/* shard to merge into this one */
+	struct fpt_shard *src;
+	/* ranks whose item-chains are rebuilt by this thread */
+	size_t rfrom, rto;
+	/* all the shards, for rebuilding the item-chains */
+	struct fpt_shard *all;
+	size_t nshards;
+	struct table *out;
+	pthread_t tid;
+};
 
-static struct fptree_node *fpt_node_new()
+static void *fpt_build_shard(void *arg)
 {
-	struct fptree_node *ret = calloc(1, sizeof(ret[0]));
-	ret->sz_children = INITIAL_SIZE;
-	ret->children = calloc(ret->sz_children, sizeof(ret->children[0]));
-	return ret;
+	struct fpt_shard *sh = arg;
+	size_t t;
+
+	for (t = sh->from; t < sh->to; t++)
+		fpt_add_transaction(sh->db->items + sh->db->offsets[t],
+				sh->db->offsets[t + 1] - sh->db->offsets[t],
+				1, sh->tree, sh->table, sh->arena);
+	return NULL;
 }
 
-#undef INITIAL_SIZE
+/**
+ * Merge the children of src into dst, in order. New subtrees are moved
+ * over as they are, nodes merged into an existing one get a zero count.
+ * This gives the tree built by inserting the transactions of dst and then
+ * those of src.
+ */
+static void fpt_merge_nodes(struct fptree_node *dst,
+		struct fptree_node *src, struct arena *a)
+{
+	struct fptree_node *c, *d;
+	int i;
+
+	for (i = 0; i < src->num_children; i++) {
+		c = src->children[i];
+		d = fpt_find_child(dst, c->val);
+		if (d) {
+			d->cnt += c->cnt;
+			fpt_merge_nodes(d, c, a);
+			c->cnt = 0;
+		} else {
+			fpt_node_add_child(dst, c, a);
+			c->parent = dst;
+		}
+	}
+}
 
-static void fpt_add_transaction(const int *t, int c, int sz,
-		struct fptree_node *fpn, struct table *tb)
+static void *fpt_merge_shard(void *arg)
 {
-	struct fptree_node *n;
-	int i, elem = t[c];
+	struct fpt_shard *sh = arg;
 
-	if (c >= sz)
-		return;
+	fpt_merge_nodes(sh->tree, sh->src->tree, sh->arena);
+	arena_adopt(sh->arena, sh->src->arena);
+	sh->src->arena = NULL;
+	return NULL;
+}
 
-	for (i = 0; i < fpn->num_children; i++)
-		if (fpn->children[i]->val == elem) {
-			fpn->children[i]->cnt++;
-			fpt_add_transaction(t, c + 1, sz, fpn->children[i], tb);
-			return;
-		}
+/**
+ * Nodes are created in transaction order both in the serial tree and in
+ * each shard, so the item-chains of the serial tree are the chains of the
+ * shards, in order, without the nodes merged away.
+ */
+static void *fpt_link_shards(void *arg)
+{
+	struct fpt_shard *sh = arg;
+	struct fptree_node *p, *next, *last;
+	size_t r, k;
 
-	if (fpn->num_children == fpn->sz_children) {
-		fpn->sz_children *= 2;
-		fpn->children = realloc(fpn->children, fpn->sz_children * sizeof(fpn->children));
-	}
-	n = fpt_node_new();
-	n->val = elem;
-	n->cnt = 1;
-	i = tb[elem-1].rpi;
-	if (tb[i].fst == NULL)
-		tb[i].fst = tb[i].lst = n;
-	else {
-		tb[i].lst->next = n;
-		tb[i].lst = n;
+	for (r = sh->rfrom; r < sh->rto; r++) {
+		last = NULL;
+		for (k = 0; k < sh->nshards; k++)
+			for (p = sh->all[k].table[r].fst; p; p = next) {
+				next = p == sh->all[k].table[r].lst ?
+					NULL : p->next;
+				if (!p->cnt)
+					continue;
+				if (last)
+					last->next = p;
+				else
+					sh->out[r].fst = p;
+				last = p;
+			}
+		if (last)
+			last->next = NULL;
+		sh->out[r].lst = last;
 	}
-	fpn->children[fpn->num_children++] = n;
-	n->parent = fpn;
-	fpt_add_transaction(t, c + 1, sz, n, tb);
+	return NULL;
+}
+
+static void fpt_run_shards(struct fpt_shard *shs, size_t n, size_t step,
+		void *(*fun)(void *))
+{
+	size_t i;
+
+	for (i = 0; i < n; i += step)
+		if (pthread_create(&shs[i].tid, NULL, fun, &shs[i]))
+			die("Unable to start tree builder thread");
+	for (i = 0; i < n; i += step)
+		pthread_join(shs[i].tid, NULL);
+}
+
+/**
+ * Build one tree per shard of the transactions in parallel, merge them
+ * pairwise in parallel and finally rebuild the item-chains. The result is
+ * the same as the tree build_tree creates.
+ */
+static void build_tree_parallel(const struct tdb *db, struct fptree *fp,
+		size_t nthreads)
+{
+	struct fpt_shard *shs = calloc(nthreads, sizeof(shs[0]));
+	size_t i, step;
+
+	for (i = 0; i < nthreads; i++) {
+		shs[i].db = db;
+		shs[i].from = db->t * i / nthreads;
+		shs[i].to = db->t * (i + 1) / nthreads;
+		shs[i].table = calloc(fp->n, sizeof(shs[i].table[0]));
+		memcpy(shs[i].table, fp->table,
+				fp->n * sizeof(shs[i].table[0]));
+		shs[i].arena = i ? arena_new(hugepages) : fp->arena;
+		shs[i].tree = i ? fpt_node_new(shs[i].arena) : fp->tree;
+		shs[i].all = shs;
+		shs[i].nshards = nthreads;
+		shs[i].out = fp->table;
+		shs[i].rfrom = fp->n * i / nthreads;
+		shs[i].rto = fp->n * (i + 1) / nthreads;
+	}
+	fpt_run_shards(shs, nthreads, 1, fpt_build_shard);
+
+	for (step = 1; step < nthreads; step *= 2) {
+		for (i = 0; i + step < nthreads; i += 2 * step)
+			shs[i].src = &shs[i + step];
+		/* a last shard without a pair waits for the next round */
+		fpt_run_shards(shs, nthreads - step, 2 * step,
+				fpt_merge_shard);
+	}
+
+	fpt_run_shards(shs, nthreads, 1, fpt_link_shards);
+
+	for (i = 0; i < nthreads; i++)
+		free(shs[i].table);
+	free(shs);
 }
 
-static void fpt_node_free(const struct fptree_node *r)
+/* size of a malloc chunk serving a request of sz bytes (glibc, 64 bit) */
+static size_t malloc_chunk_size(size_t sz)
 {
+	sz = (sz + 8 + 15) & ~15UL;
+	return sz < 32 ? 32 : sz;
+}
+
+/**
+ * Memory the tree would need if every node and every children vector was
+ * allocated separately: 10 initial children, doubled when full.
+ */
+static size_t fpt_malloc_layout_size(const struct fptree_node *r)
+{
+	size_t ret, sz = 10;
 	int i;
 
+	while ((size_t)r->num_children > sz)
+		sz *= 2;
+	ret = malloc_chunk_size(6 * sizeof(void *)) +
+		malloc_chunk_size(sz * sizeof(r->children[0]));
+
 	for (i = 0; i < r->num_children; i++)
-		fpt_node_free(r->children[i]);
-	free(r->children);
-	free((void*)r);
+		ret += fpt_malloc_layout_size(r->children[i]);
+
+	return ret;
 }
 
 static int fpt_get_height(const struct fptree_node *r)
@@ -237,6 +464,40 @@ static int fpt_get_nodes(const struct fptree_node *r)
 	return ret;
 }
 
+/* bucket 0 counts leaves, bucket b counts fanouts in [2^(b-1), 2^b) */
+static void fpt_get_fanouts(const struct fptree_node *r, size_t *buckets,
+		size_t *indexed, int *maxf)
+{
+	int i;
+
+	buckets[r->num_children ? 32 - __builtin_clz(r->num_children) : 0]++;
+	if (r->sz_children > FP_HASH_FANOUT)
+		(*indexed)++;
+	if (*maxf < r->num_children)
+		*maxf = r->num_children;
+	for (i = 0; i < r->num_children; i++)
+		fpt_get_fanouts(r->children[i], buckets, indexed, maxf);
+}
+
+static void fpt_print_fanouts(const struct fptree_node *r)
+{
+	size_t buckets[33] = {0}, indexed = 0;
+	int b, maxf = 0;
+
+	fpt_get_fanouts(r, buckets, &indexed, &maxf);
+	printf("Fanout: max %d, %lu indexed nodes,", maxf, indexed);
+	for (b = 0; b < 33; b++) {
+		if (!buckets[b])
+			continue;
+		if (b < 2)
+			printf(" %d:%lu", b, buckets[b]);
+		else
+			printf(" %ld-%ld:%lu", 1L << (b - 1), (1L << b) - 1,
+					buckets[b]);
+	}
+	printf("\n");
+}
+
 static void fpt_node_print(const struct fptree_node *r, int gap)
 {
 	int i, j;
@@ -252,9 +513,21 @@ static void fpt_node_print(const struct fptree_node *r, int gap)
 	}
 }
 
+static void flat_tree_print(const struct fpt_flat *flat)
+{
+	uint32_t i;
+
+	for (i = 0; i < flat->nodes; i++)
+		printf("%u %d %d %u %u\n", i, flat->rank[i], flat->cnt[i],
+				flat->parent[i], flat->depth[i]);
+}
+
 void fpt_tree_print(const struct fptree *fp)
 {
-	fpt_node_print(fp->tree, 0);
+	if (fp->flat)
+		flat_tree_print(fp->flat);
+	else
+		fpt_node_print(fp->tree, 0);
 }
 
 void fpt_table_print(const struct fptree *fp)
@@ -264,6 +537,15 @@ void fpt_table_print(const struct fptree *fp)
 	int n = fp->n;
 	int i;
 
+	if (fp->flat) {
+		for (i = 0; i < n; i++)
+			printf("%d] %lu %lu %lu | %u -> %u\n", i, table[i].val,
+					table[i].cnt, table[i].rpi,
+					fp->flat->chain[i],
+					fp->flat->chain[i + 1]);
+		return;
+	}
+
 	for (i = 0; i < n; i++) {
 		printf("%d] %lu %lu %lu | %p -> %p |", i, table[i].val, table[i].cnt, table[i].rpi, table[i].fst, table[i].lst);
 		p = table[i].fst;
@@ -275,96 +557,1504 @@ void fpt_table_print(const struct fptree *fp)
 	}
 }
 
-void fpt_read_from_file(const char *fname, struct fptree *fp)
+static void flat_count_nodes(const struct fptree_node *r,
+		const struct table *tb, uint32_t *cnt)
 {
-	FILE *f = fopen(fname, "r");
+	int i;
 
-	if (!f)
-		die("Invalid transaction filename %s", fname);
+	cnt[tb[r->val - 1].rpi]++;
+	for (i = 0; i < r->num_children; i++)
+		flat_count_nodes(r->children[i], tb, cnt);
+}
 
-	printf("Reading file to determine counts of items ... ");
+static void flat_place_nodes(const struct fptree_node *r, uint32_t parent,
+		uint32_t depth, const struct table *tb, uint32_t *pos,
+		struct fpt_flat *flat)
+{
+	uint32_t ix = pos[tb[r->val - 1].rpi]++;
+	int i;
+
+	flat->rank[ix] = tb[r->val - 1].rpi;
+	flat->cnt[ix] = r->cnt;
+	flat->parent[ix] = parent;
+	flat->depth[ix] = depth;
+
+	for (i = 0; i < r->num_children; i++)
+		flat_place_nodes(r->children[i], ix, depth + 1, tb, pos, flat);
+}
+
+void fpt_freeze(struct fptree *fp)
+{
+	struct fpt_flat *flat;
+	size_t nodes, i;
+	uint32_t *pos;
+	int c;
+
+	/* snapshots are mapped already frozen */
+	if (fp->flat)
+		return;
+
+	flat = calloc(1, sizeof(*flat));
+	nodes = fpt_get_nodes(fp->tree);
+
+	if (nodes > UINT32_MAX)
+		die("Tree too large to freeze: %lu nodes", nodes);
+
+	flat->nodes = nodes;
+	flat->rank = calloc(nodes, sizeof(flat->rank[0]));
+	flat->cnt = calloc(nodes, sizeof(flat->cnt[0]));
+	flat->parent = calloc(nodes, sizeof(flat->parent[0]));
+	flat->depth = calloc(nodes, sizeof(flat->depth[0]));
+	flat->chain = calloc(fp->n + 1, sizeof(flat->chain[0]));
+	pos = calloc(fp->n + 1, sizeof(pos[0]));
+
+	for (c = 0; c < fp->tree->num_children; c++)
+		flat_count_nodes(fp->tree->children[c], fp->table, pos);
+	flat->chain[0] = 1;
+	for (i = 0; i < fp->n; i++) {
+		flat->chain[i + 1] = flat->chain[i] + pos[i];
+		pos[i] = flat->chain[i];
+	}
+
+	for (c = 0; c < fp->tree->num_children; c++)
+		flat_place_nodes(fp->tree->children[c], 0, 1, fp->table, pos,
+				flat);
+
+	/* the pointer tree is not needed anymore */
+	for (i = 0; i < fp->n; i++)
+		fp->table[i].fst = fp->table[i].lst = NULL;
+	arena_free(fp->arena);
+	fp->arena = NULL;
+	fp->tree = NULL;
+	fp->flat = flat;
+
+	printf("Frozen fp-tree: %u nodes, %lu bytes\n", flat->nodes,
+			nodes * 4 * sizeof(uint32_t) +
+			(fp->n + 1) * sizeof(uint32_t));
+	free(pos);
+}
+
+/**
+ * Snapshot format: header, item[n], chain[n + 1], rank[nodes], cnt[nodes],
+ * parent[nodes], depth[nodes]. Items are fixed width records, one per rank,
+ * and nodes are referred to by index only, so the file can be mapped at any
+ * address. Integers are stored in host byte order: the header records it,
+ * along with the format version and the sizes of its records, and snapshots
+ * written by another build or on another host are rejected.
+ */
+#define FPT_SNAPSHOT_MAGIC "DPHFPT1"
+#define FPT_SNAPSHOT_VERSION 2
+/* reads back as another value on a host with another byte order */
+#define FPT_SNAPSHOT_BYTE_ORDER 0x01020304u
+
+struct fpt_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	/* sizes of this header and of an item record */
+	uint32_t header_size;
+	uint32_t item_size;
+	uint64_t n;
+	uint64_t t;
+	uint64_t nodes;
+};
+
+/* an entry of the header table, without the item-chain pointers */
+struct fpt_snapshot_item {
+	/* item value */
+	uint64_t val;
+	/* count of item */
+	uint64_t cnt;
+	/* rank of the item whose value is the index of this entry + 1 */
+	uint64_t rpi;
+};
+
+static size_t fpt_snapshot_size(const struct fpt_snapshot_header *h)
+{
+	return sizeof(*h) + h->n * sizeof(struct fpt_snapshot_item) +
+		(h->n + 1) * sizeof(uint32_t) + h->nodes * 4 * sizeof(uint32_t);
+}
+
+/* check the header fields the layout depends on, before sizing the file */
+static void fpt_check_snapshot_header(const struct fpt_snapshot_header *h,
+		const char *fname)
+{
+	if (h->byte_order != FPT_SNAPSHOT_BYTE_ORDER)
+		die("Snapshot %s was written with another byte order", fname);
+	if (h->version != FPT_SNAPSHOT_VERSION)
+		die("Snapshot %s has version %u, expected %u", fname,
+				h->version, FPT_SNAPSHOT_VERSION);
+	if (h->header_size != sizeof(*h) ||
+			h->item_size != sizeof(struct fpt_snapshot_item))
+		die("Snapshot %s was written with other record sizes", fname);
+	/* ranks are int32_t and node indices uint32_t */
+	if (h->n > INT32_MAX || !h->nodes || h->nodes > UINT32_MAX)
+		die("Corrupt fp-tree snapshot %s", fname);
+}
+
+/**
+ * Check that the mapped tree can be walked: items and ranks are permutations
+ * of each other, chains cover all the nodes, and every node has the rank of
+ * its chain and a parent before it, one level up.
+ */
+static void fpt_check_snapshot(const struct fptree *fp, const char *fname)
+{
+	const struct fpt_flat *flat = fp->flat;
+	size_t r;
+	uint32_t i;
+
+	for (r = 0; r < fp->n; r++)
+		if (fp->table[r].val < 1 || fp->table[r].val > fp->n ||
+				fp->table[r].rpi >= fp->n ||
+				fp->table[fp->table[r].rpi].val != r + 1)
+			die("Corrupt item table in snapshot %s", fname);
+
+	if (flat->chain[0] != 1 || flat->chain[fp->n] != flat->nodes)
+		die("Corrupt item-chains in snapshot %s", fname);
+	for (r = 0; r < fp->n; r++) {
+		if (flat->chain[r + 1] < flat->chain[r])
+			die("Corrupt item-chains in snapshot %s", fname);
+		for (i = flat->chain[r]; i < flat->chain[r + 1]; i++)
+			if ((size_t)flat->rank[i] != r ||
+					flat->parent[i] >= i ||
+					flat->depth[i] !=
+					flat->depth[flat->parent[i]] + 1)
+				die("Corrupt node %u in snapshot %s", i,
+						fname);
+	}
+}
+
+/**
+ * Map a snapshot file read-only, sharing the pages with every other process
+ * mapping it. Returns 0 if the file is not a snapshot.
+ */
+static int fpt_map_snapshot(const char *fname, struct fptree *fp)
+{
+	const struct fpt_snapshot_item *items;
+	struct timeval starttime, endtime;
+	struct fpt_snapshot_header h;
+	struct fpt_flat *flat;
+	struct stat st;
+	char *buf;
+	size_t r;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (read(fd, &h, sizeof(h)) != sizeof(h) ||
+			memcmp(h.magic, FPT_SNAPSHOT_MAGIC,
+				sizeof(FPT_SNAPSHOT_MAGIC))) {
+		close(fd);
+		return 0;
+	}
+
+	printf("Mapping fp-tree snapshot ... ");
 	fflush(stdout);
-	single_item_stat(f, fp);
+	gettimeofday(&starttime, NULL);
+	fpt_check_snapshot_header(&h, fname);
+	if (fstat(fd, &st) < 0)
+		die("Unable to stat %s", fname);
+	if ((size_t)st.st_size != fpt_snapshot_size(&h))
+		die("Corrupt fp-tree snapshot %s", fname);
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED)
+		die("Unable to map %s", fname);
+	close(fd);
+
+	flat = calloc(1, sizeof(*flat));
+	flat->map = buf;
+	flat->bytes = st.st_size;
+	flat->nodes = h.nodes;
+	buf += sizeof(h);
+	items = (const struct fpt_snapshot_item *)buf;
+	buf += h.n * sizeof(items[0]);
+	flat->chain = (uint32_t *)buf;
+	buf += (h.n + 1) * sizeof(flat->chain[0]);
+	flat->rank = (int32_t *)buf;
+	buf += h.nodes * sizeof(flat->rank[0]);
+	flat->cnt = (int32_t *)buf;
+	buf += h.nodes * sizeof(flat->cnt[0]);
+	flat->parent = (uint32_t *)buf;
+	buf += h.nodes * sizeof(flat->parent[0]);
+	flat->depth = (uint32_t *)buf;
+
+	fp->n = h.n;
+	fp->t = h.t;
+	fp->table = calloc(fp->n, sizeof(fp->table[0]));
+	for (r = 0; r < fp->n; r++) {
+		fp->table[r].val = items[r].val;
+		fp->table[r].cnt = items[r].cnt;
+		fp->table[r].rpi = items[r].rpi;
+	}
+	fp->tree = NULL;
+	fp->arena = NULL;
+	fp->flat = flat;
+	fp->cache = NULL;
+	fp->vert = NULL;
+	fpt_check_snapshot(fp, fname);
+	gettimeofday(&endtime, NULL);
+
+	printf("OK (%u nodes, %.2lf MB in %.3lf s)\n", flat->nodes,
+			flat->bytes / MB, (endtime.tv_sec - starttime.tv_sec) +
+			(0.0 + endtime.tv_usec - starttime.tv_usec) /
+			MICROSECONDS);
+	return 1;
+}
+
+void fpt_save_snapshot(const struct fptree *fp, const char *fname)
+{
+	const struct fpt_flat *flat = fp->flat;
+	struct fpt_snapshot_item *items;
+	struct fpt_snapshot_header h;
+	size_t i;
+	FILE *f;
+
+	if (!flat)
+		die("Only frozen trees can be saved");
+
+	f = fopen(fname, "w");
+	if (!f)
+		die("Unable to save file %s", fname);
+
+	printf("Saving fp-tree snapshot to %s ... ", fname);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FPT_SNAPSHOT_MAGIC, sizeof(FPT_SNAPSHOT_MAGIC));
+	h.version = FPT_SNAPSHOT_VERSION;
+	h.byte_order = FPT_SNAPSHOT_BYTE_ORDER;
+	h.header_size = sizeof(h);
+	h.item_size = sizeof(items[0]);
+	h.n = fp->n;
+	h.t = fp->t;
+	h.nodes = flat->nodes;
+
+	items = calloc(fp->n, sizeof(items[0]));
+	for (i = 0; i < fp->n; i++) {
+		items[i].val = fp->table[i].val;
+		items[i].cnt = fp->table[i].cnt;
+		items[i].rpi = fp->table[i].rpi;
+	}
+
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(items, sizeof(items[0]), fp->n, f);
+	fwrite(flat->chain, sizeof(flat->chain[0]), fp->n + 1, f);
+	fwrite(flat->rank, sizeof(flat->rank[0]), flat->nodes, f);
+	fwrite(flat->cnt, sizeof(flat->cnt[0]), flat->nodes, f);
+	fwrite(flat->parent, sizeof(flat->parent[0]), flat->nodes, f);
+	fwrite(flat->depth, sizeof(flat->depth[0]), flat->nodes, f);
+
+	if (fclose(f))
+		die("Unable to write file %s", fname);
 	printf("OK\n");
+	free(items);
+}
+
+void fpt_use_hugepages(int on)
+{
+	hugepages = on;
+}
+
+void fpt_read_from_file(const char *fname, size_t nthreads,
+		struct fptree *fp)
+{
+	struct timeval starttime, endtime;
+	double build_time;
+	struct tdb db;
+	size_t mem, shards;
+
+	if (fpt_map_snapshot(fname, fp))
+		return;
 
-	fp->tree = fpt_node_new();
-	printf("Reading file to build fp-tree ... ");
+	printf("Parsing transactions ... ");
 	fflush(stdout);
-	read_transactions(f, fp);
-	printf("OK\n");
+	tdb_load(fname, nthreads, &db);
+	build_table(&db, fp);
+	printf("OK (%.2lf MB in %.3lf s, %.2lf MB/s)\n", db.bytes / MB,
+			db.time, div_or_zero(db.bytes / MB, db.time));
+
+	fp->arena = arena_new(hugepages);
+	fp->tree = fpt_node_new(fp->arena);
+	fp->flat = NULL;
+	fp->cache = NULL;
+	fp->vert = NULL;
+	printf("Building fp-tree ... ");
+	fflush(stdout);
+	gettimeofday(&starttime, NULL);
+	/* merging shards costs more than it saves on small inputs */
+	shards = min(nthreads, db.t / FP_SHARD_MIN);
+	if (shards > 1)
+		build_tree_parallel(&db, fp, shards);
+	else
+		build_tree(&db, fp);
+	gettimeofday(&endtime, NULL);
+	build_time = (endtime.tv_sec - starttime.tv_sec) +
+		(0.0 + endtime.tv_usec - starttime.tv_usec) / MICROSECONDS;
+	printf("OK (%.3lf s, %.3lf s per million transactions)\n",
+			build_time, div_or_zero(build_time * 1e6, fp->t));
+	fpt_print_fanouts(fp->tree);
+
+	mem = fpt_malloc_layout_size(fp->tree);
+	printf("Node arena: %lu bytes used, %lu mapped, %lu saved over "
+			"per-node allocation (%lu)\n", arena_used(fp->arena),
+			arena_reserved(fp->arena),
+			mem - min(mem, arena_used(fp->arena)), mem);
 
-	fclose(f);
+	tdb_cleanup(&db);
 }
 
-void fpt_cleanup(const struct fptree *fp)
+static void flat_free(struct fpt_flat *flat)
 {
-	free(fp->table);
-	fpt_node_free(fp->tree);
+	if (flat->map)
+		munmap(flat->map, flat->bytes);
+	else {
+		free(flat->rank);
+		free(flat->cnt);
+		free(flat->parent);
+		free(flat->depth);
+		free(flat->chain);
+	}
+	free(flat);
 }
 
-int fpt_height(const struct fptree *fp)
+/**
+ * Rebuild the pointer tree of a frozen tree. Parents have smaller ranks than
+ * their children, so they come first in the flat layout.
+ */
+static void fpt_thaw(struct fptree *fp)
 {
-	return fpt_get_height(fp->tree);
+	struct fpt_flat *flat = fp->flat;
+	struct fptree_node **nodes;
+	struct table *tb;
+	uint32_t i;
+
+	if (fp->cache || fp->vert)
+		die("Cannot change a tree with a cache or a vertical index");
+
+	tb = calloc(fp->n, sizeof(tb[0]));
+	memcpy(tb, fp->table, fp->n * sizeof(tb[0]));
+	fp->arena = arena_new(hugepages);
+	fp->tree = fpt_node_new(fp->arena);
+
+	nodes = calloc(flat->nodes, sizeof(nodes[0]));
+	nodes[0] = fp->tree;
+	for (i = 1; i < flat->nodes; i++)
+		nodes[i] = fpt_new_child(nodes[flat->parent[i]],
+				flat->rank[i], flat->cnt[i], tb, fp->arena);
+
+	free(fp->table);
+	flat_free(flat);
+	fp->table = tb;
+	fp->flat = NULL;
+	free(nodes);
 }
 
-int fpt_nodes(const struct fptree *fp)
+/* decreasing support, ties broken by item value, as in the input */
+static int table_cmp(const void *a, const void *b)
 {
-	return fpt_get_nodes(fp->tree);
+	const struct table *ta = a, *tb = b;
+
+	if (ta->cnt != tb->cnt)
+		return ta->cnt < tb->cnt ? 1 : -1;
+	return ta->val < tb->val ? -1 : ta->val > tb->val;
 }
 
-int fpt_item_count(const struct fptree *fp, int it)
+/* number of inversions in a, sorting it by merging into tmp */
+static size_t count_inversions(int *a, int *tmp, size_t n)
 {
-	if (it < 0 || (size_t)it >= fp->n)
+	size_t i, j, k, m = n / 2, ret;
+
+	if (n < 2)
 		return 0;
-	return fp->table[fp->table[it].rpi].cnt;
+	ret = count_inversions(a, tmp, m) + count_inversions(a + m, tmp, n - m);
+
+	for (i = 0, j = m, k = 0; i < m && j < n; k++)
+		if (a[j] < a[i]) {
+			ret += m - i;
+			tmp[k] = a[j++];
+		} else
+			tmp[k] = a[i++];
+	while (i < m)
+		tmp[k++] = a[i++];
+	while (j < n)
+		tmp[k++] = a[j++];
+	memcpy(a, tmp, n * sizeof(a[0]));
+
+	return ret;
 }
 
-static int search_on_path(const struct fptree_node *n,
-		const int *key, int keylen)
+/**
+ * Rank the items by their current support, filling the new rank of each old
+ * rank. Returns the drift of the order: the fraction of pairs of items whose
+ * relative order changes.
+ */
+static double fpt_rerank(const struct fptree *fp, int *newrank)
 {
-	int i = keylen - 2;
-	struct fptree_node *p = n->parent;
+	struct table *tb = calloc(fp->n, sizeof(tb[0]));
+	int *seq = calloc(2 * fp->n, sizeof(seq[0]));
+	size_t i, inv;
 
-	while (p && i >= 0) {
-		/* cut */
-		if (i > 0 && p->val == key[i-1])
-			return 0;
-		/* found */
-		if (p->val == key[i])
-			i--;
-		p = p->parent;
-	}
+	memcpy(tb, fp->table, fp->n * sizeof(tb[0]));
+	qsort(tb, fp->n, sizeof(tb[0]), table_cmp);
+	for (i = 0; i < fp->n; i++)
+		newrank[fp->table[tb[i].val - 1].rpi] = i;
 
-	if (!p)
-		return 0;
+	memcpy(seq, newrank, fp->n * sizeof(seq[0]));
+	inv = count_inversions(seq, seq + fp->n, fp->n);
 
-	return n->cnt;
+	free(seq);
+	free(tb);
+	return div_or_zero(inv, fp->n * (fp->n - 1) / 2.0);
 }
 
-int fpt_itemset_count(const struct fptree *fp, const int *its, int itslen)
+/**
+ * Insert the paths ending in the subtree of r into the tree of nfp, with the
+ * ranks of nfp. A path ends in a node if its count exceeds the counts of its
+ * children.
+ */
+static void fpt_replay_paths(const struct fptree_node *r, int *path,
+		int *key, int depth, const struct fptree *fp,
+		const int *newrank, struct fptree *nfp)
 {
-	int *search_key = calloc(itslen, sizeof(search_key[0]));
-	int i, count = 0, key_len = 0;
-	struct fptree_node *p, *l;
+	int i, j, cnt = r->cnt;
 
-	for (i = 0; i < itslen; i++)
-		if (its[i] > 0)
-			search_key[key_len++] = fp->table[its[i] - 1].rpi;
-	qsort(search_key, key_len, sizeof(search_key[0]), int_cmp);
-	for (i = 0; i < key_len; i++)
-		search_key[i] = fp->table[search_key[i]].val;
+	if (depth) {
+		path[depth - 1] = newrank[fp->table[r->val - 1].rpi];
+		for (i = 0; i < r->num_children; i++)
+			cnt -= r->children[i]->cnt;
+	}
 
-	i = fp->table[search_key[key_len - 1] - 1].rpi;
-	p = fp->table[i].fst;
-	l = fp->table[i].lst;
+	if (depth && cnt > 0) {
+		for (i = 0; i < depth; i++) {
+			for (j = i; j > 0 && key[j - 1] > path[i]; j--)
+				key[j] = key[j - 1];
+			key[j] = path[i];
+		}
+		fpt_add_transaction(key, depth, cnt, nfp->tree, nfp->table,
+				nfp->arena);
+	}
 
-	while (p && p != l) {
-		count += search_on_path(p, search_key, key_len);
-		p = p->next;
+	for (i = 0; i < r->num_children; i++)
+		fpt_replay_paths(r->children[i], path, key, depth + 1, fp,
+				newrank, nfp);
+}
+
+/* rebuild the tree with the items ranked by newrank */
+static void fpt_restructure(struct fptree *fp, const int *newrank)
+{
+	int *path = calloc(2 * fpt_get_height(fp->tree), sizeof(path[0]));
+	int *key = path + fpt_get_height(fp->tree);
+	struct fptree nfp;
+	size_t i;
+
+	nfp.n = fp->n;
+	nfp.table = calloc(fp->n, sizeof(nfp.table[0]));
+	for (i = 0; i < fp->n; i++) {
+		nfp.table[newrank[i]].val = fp->table[i].val;
+		nfp.table[newrank[i]].cnt = fp->table[i].cnt;
 	}
-	if (p)
-		count += search_on_path(p, search_key, key_len);
+	for (i = 0; i < fp->n; i++)
+		nfp.table[nfp.table[i].val - 1].rpi = i;
+	nfp.arena = arena_new(hugepages);
+	nfp.tree = fpt_node_new(nfp.arena);
 
-	free(search_key);
-	return count;
+	fpt_replay_paths(fp->tree, path, key, 0, fp, newrank, &nfp);
+
+	arena_free(fp->arena);
+	free(fp->table);
+	fp->table = nfp.table;
+	fp->tree = nfp.tree;
+	fp->arena = nfp.arena;
+	free(path);
+}
+
+void fpt_rebalance(struct fptree *fp, double tolerance)
+{
+	int *newrank = calloc(fp->n, sizeof(newrank[0]));
+	double drift;
+
+	if (fp->flat)
+		die("Cannot rebalance a frozen tree");
+
+	drift = fpt_rerank(fp, newrank);
+	printf("Rank drift: %.4lf, tolerance %.4lf\n", drift, tolerance);
+	if (drift > tolerance) {
+		printf("Restructuring fp-tree ... ");
+		fflush(stdout);
+		fpt_restructure(fp, newrank);
+		printf("OK\n");
+	}
+
+	free(newrank);
+}
+
+void fpt_append_file(struct fptree *fp, const char *fname, size_t nthreads,
+		double tolerance)
+{
+	size_t i, j, n = fp->n, sz, ksz = 0;
+	int *map, *key = NULL;
+	struct tdb db;
+
+	if (fp->flat)
+		fpt_thaw(fp);
+
+	printf("Appending transactions ... ");
+	fflush(stdout);
+	tdb_load(fname, nthreads, &db);
+
+	/* new items are ranked last, in the order of the appended file */
+	if (db.n > fp->n) {
+		fp->table = realloc(fp->table, db.n * sizeof(fp->table[0]));
+		memset(fp->table + n, 0, (db.n - n) * sizeof(fp->table[0]));
+		for (i = 0; i < db.n; i++)
+			if ((size_t)db.order[i] > n) {
+				fp->table[fp->n].val = db.order[i];
+				fp->table[db.order[i] - 1].rpi = fp->n++;
+			}
+	}
+
+	map = calloc(db.n, sizeof(map[0]));
+	for (i = 0; i < db.n; i++) {
+		map[i] = fp->table[db.order[i] - 1].rpi;
+		fp->table[map[i]].cnt += db.supports[i];
+	}
+
+	for (i = 0; i < db.t; i++) {
+		sz = db.offsets[i + 1] - db.offsets[i];
+		if (sz > ksz) {
+			ksz = sz;
+			key = realloc(key, ksz * sizeof(key[0]));
+		}
+		for (j = 0; j < sz; j++)
+			key[j] = map[db.items[db.offsets[i] + j]];
+		qsort(key, sz, sizeof(key[0]), int_cmp);
+		fpt_add_transaction(key, sz, 1, fp->tree, fp->table,
+				fp->arena);
+	}
+	fp->t += db.t;
+	printf("OK (%lu transactions, %lu new items in %.3lf s)\n", db.t,
+			fp->n - n, db.time);
+
+	fpt_rebalance(fp, tolerance);
+
+	free(key);
+	free(map);
+	tdb_cleanup(&db);
+}
+
+/* give ranks to items up to value val, in increasing order of values */
+static void fpt_grow_table(struct fptree *fp, size_t val)
+{
+	size_t i;
+
+	if (val <= fp->n)
+		return;
+
+	fp->table = realloc(fp->table, val * sizeof(fp->table[0]));
+	memset(fp->table + fp->n, 0, (val - fp->n) * sizeof(fp->table[0]));
+	for (i = fp->n; i < val; i++) {
+		fp->table[i].val = i + 1;
+		fp->table[i].rpi = i;
+	}
+	fp->n = val;
+}
+
+/* remove a node with a zero count, having no children left */
+static void fpt_unlink_node(struct fptree_node *n, int rank,
+		struct table *tb, struct arena *a)
+{
+	struct fptree_node *fpn = n->parent, *p;
+	int i;
+
+	for (i = 0; fpn->children[i] != n; i++);
+	memmove(fpn->children + i, fpn->children + i + 1,
+			(fpn->num_children - i - 1) * sizeof(fpn->children[0]));
+	fpn->num_children--;
+	if (fpn->sz_children > FP_HASH_FANOUT)
+		fpt_reindex_children(fpn);
+
+	/* item-chains are singly linked, find the previous node */
+	if (tb[rank].fst == n) {
+		tb[rank].fst = n == tb[rank].lst ? NULL : n->next;
+		if (!tb[rank].fst)
+			tb[rank].lst = NULL;
+	} else {
+		for (p = tb[rank].fst; p->next != n; p = p->next);
+		p->next = n->next;
+		if (tb[rank].lst == n)
+			tb[rank].lst = p;
+	}
+
+	if (n->sz_children)
+		arena_release(a, n->children,
+				fpt_children_slots(n->sz_children) *
+				sizeof(n->children[0]));
+	arena_release(a, n, sizeof(*n));
+}
+
+/**
+ * Remove one occurrence of a transaction, given as sorted ranks. Nodes
+ * reaching a zero count are unlinked, deepest first.
+ */
+static void fpt_remove_transaction(const int *t, int sz,
+		struct fptree_node *fpn, struct table *tb, struct arena *a)
+{
+	struct fptree_node *n;
+	int c;
+
+	for (c = 0; c < sz; c++, fpn = n) {
+		n = fpt_find_child(fpn, tb[t[c]].val);
+		n->cnt--;
+		tb[t[c]].cnt--;
+	}
+
+	for (c = sz - 1; c >= 0 && !fpn->cnt; c--) {
+		n = fpn->parent;
+		fpt_unlink_node(fpn, t[c], tb, a);
+		fpn = n;
+	}
+}
+
+/* sorted ranks of the items of a transaction */
+static int fpt_window_key(const struct fptree *fp, const int *its, int len,
+		int *key)
+{
+	int i, j, r, sz = 0;
+
+	for (i = 0; i < len; i++) {
+		r = fp->table[its[i] - 1].rpi;
+		for (j = sz++; j > 0 && key[j - 1] > r; j--)
+			key[j] = key[j - 1];
+		key[j] = r;
+	}
+	return sz;
+}
+
+void fpt_window_init(struct fpt_window *w, size_t size)
+{
+	memset(w, 0, sizeof(*w));
+	w->fp.arena = arena_new(hugepages);
+	w->fp.tree = fpt_node_new(w->fp.arena);
+	w->size = size;
+	w->its = calloc(size, sizeof(w->its[0]));
+	w->len = calloc(size, sizeof(w->len[0]));
+	w->stamp = calloc(size, sizeof(w->stamp[0]));
+}
+
+/* cached supports are stale once the window moves */
+static void fpt_window_changed(struct fpt_window *w)
+{
+	if (w->fp.cache) {
+		free_support_cache(w->fp.cache);
+		w->fp.cache = NULL;
+	}
+}
+
+static void fpt_window_pop(struct fpt_window *w)
+{
+	int *key = calloc(w->len[w->head] + 1, sizeof(key[0]));
+	int sz;
+
+	sz = fpt_window_key(&w->fp, w->its[w->head], w->len[w->head], key);
+	fpt_remove_transaction(key, sz, w->fp.tree, w->fp.table, w->fp.arena);
+	free(w->its[w->head]);
+	w->its[w->head] = NULL;
+	w->head = (w->head + 1) % w->size;
+	w->fp.t--;
+	free(key);
+}
+
+void fpt_window_add(struct fpt_window *w, const int *its, int len,
+		long stamp)
+{
+	int *key, *t, i, sz = 0;
+	size_t tail;
+
+	fpt_window_changed(w);
+	if (w->fp.t == w->size)
+		fpt_window_pop(w);
+
+	t = calloc(len + 1, sizeof(t[0]));
+	for (i = 0; i < len; i++)
+		if (its[i] > 0) {
+			t[sz++] = its[i];
+			fpt_grow_table(&w->fp, its[i]);
+		}
+
+	key = calloc(sz + 1, sizeof(key[0]));
+	fpt_window_key(&w->fp, t, sz, key);
+	for (i = 0; i < sz; i++)
+		w->fp.table[key[i]].cnt++;
+	fpt_add_transaction(key, sz, 1, w->fp.tree, w->fp.table,
+			w->fp.arena);
+	free(key);
+
+	tail = (w->head + w->fp.t) % w->size;
+	w->its[tail] = t;
+	w->len[tail] = sz;
+	w->stamp[tail] = stamp;
+	w->fp.t++;
+}
+
+size_t fpt_window_expire(struct fpt_window *w, long stamp)
+{
+	size_t ret = 0;
+
+	fpt_window_changed(w);
+	for (; w->fp.t && w->stamp[w->head] < stamp; ret++)
+		fpt_window_pop(w);
+	return ret;
+}
+
+void fpt_window_cleanup(struct fpt_window *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->size; i++)
+		free(w->its[i]);
+	free(w->its);
+	free(w->len);
+	free(w->stamp);
+	fpt_cleanup(&w->fp);
+}
+
+void fpt_cleanup(const struct fptree *fp)
+{
+	if (fp->arena)
+		arena_free(fp->arena);
+	if (fp->cache)
+		free_support_cache(fp->cache);
+	if (fp->vert)
+		free_vertical(fp->vert);
+	free(fp->table);
+	if (fp->flat)
+		flat_free(fp->flat);
+}
+
+int fpt_height(const struct fptree *fp)
+{
+	uint32_t i, ret = 0;
+
+	if (!fp->flat)
+		return fpt_get_height(fp->tree);
+
+	for (i = 0; i < fp->flat->nodes; i++)
+		if (ret < fp->flat->depth[i])
+			ret = fp->flat->depth[i];
+	return ret + 1;
+}
+
+int fpt_nodes(const struct fptree *fp)
+{
+	if (!fp->flat)
+		return fpt_get_nodes(fp->tree);
+	return fp->flat->nodes;
+}
+
+int fpt_item_count(const struct fptree *fp, int it)
+{
+	if (it < 0 || (size_t)it >= fp->n)
+		return 0;
+	return fp->table[fp->table[it].rpi].cnt;
+}
+
+static int search_on_path(const struct fptree_node *n,
+		const int *key, int keylen)
+{
+	int i = keylen - 2;
+	struct fptree_node *p = n->parent;
+
+	while (p && i >= 0) {
+		/* cut */
+		if (i > 0 && p->val == key[i-1])
+			return 0;
+		/* found */
+		if (p->val == key[i])
+			i--;
+		p = p->parent;
+	}
+
+	if (!p)
+		return 0;
+
+	return n->cnt;
+}
+
+static int tree_chain_count(const struct table *tb, int rank,
+		const int *key, int keylen)
+{
+	struct fptree_node *p = tb[rank].fst, *l = tb[rank].lst;
+	int count = 0;
+
+	while (p && p != l) {
+		count += search_on_path(p, key, keylen);
+		p = p->next;
+	}
+	if (p)
+		count += search_on_path(p, key, keylen);
+
+	return count;
+}
+
+/**
+ * Keys are sorted ranks and ranks decrease towards the root, so the search
+ * stops once it passes the rank it is looking for.
+ */
+static int flat_search_on_path(const struct fpt_flat *flat, uint32_t n,
+		const int *key, int keylen)
+{
+	uint32_t p = flat->parent[n];
+	int i = keylen - 2;
+
+	while (p && i >= 0) {
+		/* cut */
+		if (flat->rank[p] < key[i])
+			return 0;
+		/* found */
+		if (flat->rank[p] == key[i])
+			i--;
+		p = flat->parent[p];
+	}
+
+	return i < 0 ? flat->cnt[n] : 0;
+}
+
+static int flat_chain_count(const struct fpt_flat *flat,
+		const int *key, int keylen)
+{
+	uint32_t i, end = flat->chain[key[keylen - 1] + 1];
+	int count = 0;
+
+	for (i = flat->chain[key[keylen - 1]]; i < end; i++)
+		/* paths shorter than the key cannot contain it */
+		if (flat->depth[i] >= (uint32_t)keylen)
+			count += flat_search_on_path(flat, i, key, keylen);
+
+	return count;
+}
+
+int fpt_item_rank(const struct fptree *fp, int it)
+{
+	return fp->table[it - 1].rpi;
+}
+
+int fpt_rank_item(const struct fptree *fp, int rank)
+{
+	return fp->table[rank].val;
+}
+
+static int count_ranks(const struct fptree *fp, const int *ranks, int len)
+{
+	int vals[FPT_MAXLEN];
+	int i, count;
+
+	if (fp->vert && (size_t)ranks[len - 1] < vertical_items(fp->vert))
+		count = vertical_count(fp->vert, ranks, len);
+	else if (fp->flat)
+		count = flat_chain_count(fp->flat, ranks, len);
+	else {
+		for (i = 0; i < len; i++)
+			vals[i] = fp->table[ranks[i]].val;
+		count = tree_chain_count(fp->table, ranks[len - 1], vals, len);
+	}
+
+	return count;
+}
+
+int fpt_itemset_count_ranks(const struct fptree *fp, const int *ranks,
+		int len)
+{
+	int count;
+
+	if (fp->cache && support_cache_lookup(fp->cache, ranks, len, &count))
+		return count;
+
+	count = count_ranks(fp, ranks, len);
+	if (fp->cache)
+		support_cache_insert(fp->cache, ranks, len, count);
+	return count;
+}
+
+int fpt_itemset_count(const struct fptree *fp, const int *its, int itslen)
+{
+	int search_key[FPT_MAXLEN];
+	int i, j, r, key_len = 0;
+
+	if (itslen > FPT_MAXLEN)
+		die("Itemset too long: %d items", itslen);
+
+	/* insertion sort, keys are short */
+	for (i = 0; i < itslen; i++) {
+		if (its[i] <= 0)
+			continue;
+		r = fp->table[its[i] - 1].rpi;
+		for (j = key_len++; j > 0 && search_key[j - 1] > r; j--)
+			search_key[j] = search_key[j - 1];
+		search_key[j] = r;
+	}
+
+	return fpt_itemset_count_ranks(fp, search_key, key_len);
+}
+
+struct batch_item {
+	int rank;
+	int ix;
+};
+
+static int batch_item_cmp_r(const void *a, const void *b)
+{
+	const struct batch_item *ba = a, *bb = b;
+	return bb->rank - ba->rank;
+}
+
+/**
+ * Batched counting on the frozen tree. With m the last item of the prefix,
+ * a single walk over the chain of m finds the nodes having the whole prefix
+ * on their path and, at the same time, the candidates ranked before m found
+ * on the same paths. Candidates ranked after m only need to reach the first
+ * node of m above them and check whether it was one of those nodes.
+ */
+static void flat_batch_count(const struct fpt_flat *flat, const int *prefix,
+		int plen, const int *cands, const int *ixs, int nix,
+		int *counts)
+{
+	int pm = prefix[plen - 1], nlow = 0, nhigh = 0, i, j, k, nh, r;
+	uint32_t lo = flat->chain[pm], hi = flat->chain[pm + 1], n, p;
+	struct batch_item *low, *high;
+	unsigned char *covered;
+	int *hits;
+
+	low = calloc(nix, sizeof(low[0]));
+	high = calloc(nix, sizeof(high[0]));
+	hits = calloc(nix, sizeof(hits[0]));
+	covered = calloc(hi - lo, sizeof(covered[0]));
+
+	for (i = 0; i < nix; i++) {
+		counts[ixs[i]] = 0;
+		if (cands[ixs[i]] < pm) {
+			low[nlow].rank = cands[ixs[i]];
+			low[nlow++].ix = ixs[i];
+		} else {
+			high[nhigh].rank = cands[ixs[i]];
+			high[nhigh++].ix = ixs[i];
+		}
+	}
+	/* ranks decrease towards the root, so do the candidates */
+	qsort(low, nlow, sizeof(low[0]), batch_item_cmp_r);
+
+	for (n = lo; n < hi; n++) {
+		if (flat->depth[n] < (uint32_t)plen)
+			continue;
+		k = plen - 2;
+		j = nh = 0;
+		for (p = flat->parent[n]; p && (k >= 0 || j < nlow);
+				p = flat->parent[p]) {
+			r = flat->rank[p];
+			if (k >= 0 && prefix[k] > r)
+				break;
+			if (k >= 0 && prefix[k] == r) {
+				k--;
+				continue;
+			}
+			while (j < nlow && low[j].rank > r)
+				j++;
+			if (j < nlow && low[j].rank == r)
+				hits[nh++] = low[j].ix;
+		}
+		if (k >= 0)
+			continue;
+
+		covered[n - lo] = 1;
+		for (i = 0; i < nh; i++)
+			counts[hits[i]] += flat->cnt[n];
+	}
+
+	for (i = 0; i < nhigh; i++)
+		for (n = flat->chain[high[i].rank];
+				n < flat->chain[high[i].rank + 1]; n++) {
+			if (flat->depth[n] <= (uint32_t)plen)
+				continue;
+			for (p = flat->parent[n]; p && flat->rank[p] > pm;
+					p = flat->parent[p]);
+			if (p && flat->rank[p] == pm && covered[p - lo])
+				counts[high[i].ix] += flat->cnt[n];
+		}
+
+	free(covered);
+	free(hits);
+	free(high);
+	free(low);
+}
+
+/* sorted key of a sorted prefix and one more rank */
+static inline void prefix_key(const int *prefix, int plen, int r, int *key)
+{
+	int i;
+
+	for (i = plen; i > 0 && prefix[i - 1] > r; i--)
+		key[i] = prefix[i - 1];
+	key[i] = r;
+	while (i-- > 0)
+		key[i] = prefix[i];
+}
+
+void fpt_itemset_count_batch(const struct fptree *fp, const int *prefix,
+		int plen, const int *cands, int ncands, int *counts)
+{
+	int key[FPT_MAXLEN];
+	int i, nix = 0, *ixs;
+
+	if (plen >= FPT_MAXLEN)
+		die("Itemset too long: %d items", plen + 1);
+
+	/* supports of single items are in the table */
+	if (!plen) {
+		for (i = 0; i < ncands; i++)
+			counts[i] = fp->table[cands[i]].cnt;
+		return;
+	}
+
+	ixs = calloc(ncands, sizeof(ixs[0]));
+	for (i = 0; i < ncands; i++) {
+		prefix_key(prefix, plen, cands[i], key);
+
+		if (fp->cache && support_cache_lookup(fp->cache, key,
+					plen + 1, &counts[i]))
+			continue;
+		/* tidsets and the unfrozen tree are counted one at a time */
+		if (!fp->flat || (fp->vert && (size_t)key[plen] <
+					vertical_items(fp->vert))) {
+			counts[i] = count_ranks(fp, key, plen + 1);
+			if (fp->cache)
+				support_cache_insert(fp->cache, key, plen + 1,
+						counts[i]);
+			continue;
+		}
+		ixs[nix++] = i;
+	}
+
+	if (nix)
+		flat_batch_count(fp->flat, prefix, plen, cands, ixs, nix,
+				counts);
+
+	if (fp->cache)
+		for (i = 0; i < nix; i++) {
+			prefix_key(prefix, plen, cands[ixs[i]], key);
+			support_cache_insert(fp->cache, key, plen + 1,
+					counts[ixs[i]]);
+		}
+	free(ixs);
+}
+
+/**
+ * Mask of the items of the lattice found on the path from a node of the k-th
+ * lattice item to the root. The ranks of the lattice items are sorted and
+ * ranks decrease towards the root, so the walk stops as soon as no lattice
+ * item can be found above.
+ */
+static int flat_path_mask(const struct fptree *fp, uint32_t n,
+		const int *ranks, int k)
+{
+	const struct fpt_flat *flat = fp->flat;
+	uint32_t p = flat->parent[n];
+	int mask = 1 << k, r;
+
+	while (p && k > 0) {
+		r = flat->rank[p];
+		while (k > 0 && ranks[k - 1] > r)
+			k--;
+		if (k > 0 && ranks[k - 1] == r)
+			mask |= 1 << --k;
+		p = flat->parent[p];
+	}
+
+	return mask;
+}
+
+static int tree_path_mask(const struct fptree *fp,
+		const struct fptree_node *n, const int *ranks, int k)
+{
+	const struct fptree_node *p = n->parent;
+	int mask = 1 << k, r;
+
+	while (p && p->parent && k > 0) {
+		r = fp->table[p->val - 1].rpi;
+		while (k > 0 && ranks[k - 1] > r)
+			k--;
+		if (k > 0 && ranks[k - 1] == r)
+			mask |= 1 << --k;
+		p = p->parent;
+	}
+
+	return mask;
+}
+
+/* supports of the subsets of the sorted ranks, in one pass over the tree */
+static void tree_lattice(const struct fptree *fp, const int *ranks, int itslen,
+		int *exact)
+{
+	int i, k, m, full = 1 << itslen;
+	struct fptree_node *p;
+	uint32_t n;
+
+	memset(exact, 0, full * sizeof(exact[0]));
+
+	/*
+	 * Each node of the k-th item adds its count to the set of lattice
+	 * items on its path, in which k is the last item.
+	 */
+	for (k = 0; k < itslen; k++) {
+		if (fp->flat)
+			for (n = fp->flat->chain[ranks[k]];
+					n < fp->flat->chain[ranks[k] + 1]; n++)
+				exact[flat_path_mask(fp, n, ranks, k)] +=
+					fp->flat->cnt[n];
+		else
+			for (p = fp->table[ranks[k]].fst; p; p = p->next) {
+				exact[tree_path_mask(fp, p, ranks, k)] += p->cnt;
+				if (p == fp->table[ranks[k]].lst)
+					break;
+			}
+	}
+
+	/*
+	 * Support of a set is the sum over its supersets having the same last
+	 * item, so sum only over bits below the last one.
+	 */
+	for (i = 0; i < itslen; i++)
+		for (m = 0; m < full; m++)
+			if (!(m & (1 << i)) && (m >> (i + 1)))
+				exact[m] += exact[m | (1 << i)];
+}
+
+/* ranks of the subset m of the sorted ranks, a cache key */
+static int subset_ranks(const int *ranks, int itslen, int m, int *sub)
+{
+	int i, len = 0;
+
+	for (i = 0; i < itslen; i++)
+		if (m & (1 << i))
+			sub[len++] = ranks[i];
+	return len;
+}
+
+/*
+ * Supports of the non empty subsets found in the cache, flagged in cached.
+ * Returns the number of subsets missing.
+ */
+static int cached_lattice(const struct fptree *fp, const int *ranks,
+		int itslen, int *exact, char *cached)
+{
+	int sub[FPT_MAXLEN], m, len, missing = 0;
+
+	for (m = 1; m < 1 << itslen; m++) {
+		len = subset_ranks(ranks, itslen, m, sub);
+		cached[m] = support_cache_lookup(fp->cache, sub, len,
+				&exact[m]);
+		missing += !cached[m];
+	}
+	return missing;
+}
+
+void fpt_itemset_lattice(const struct fptree *fp, const int *its, int itslen,
+		int *sups)
+{
+	int ranks[FPT_MAXLEN], bits[FPT_MAXLEN], exact[1 << FPT_MAXLEN];
+	int sub[FPT_MAXLEN], i, j, k, m, len, full = 1 << itslen;
+	char cached[1 << FPT_MAXLEN];
+
+	if (itslen > FPT_MAXLEN)
+		die("Itemset too long: %d items", itslen);
+
+	/* sort the ranks, remembering the position of each in its */
+	for (i = 0; i < itslen; i++) {
+		k = fp->table[its[i] - 1].rpi;
+		for (j = i; j > 0 && ranks[j - 1] > k; j--) {
+			ranks[j] = ranks[j - 1];
+			bits[j] = bits[j - 1];
+		}
+		ranks[j] = k;
+		bits[j] = 1 << i;
+	}
+
+	/*
+	 * Subsets of indexed items are intersected, going through the cache
+	 * like any count. Otherwise the tree pass fills in the cache, unless
+	 * it already holds the whole lattice.
+	 */
+	if (fp->vert && (size_t)ranks[itslen - 1] < vertical_items(fp->vert))
+		for (m = 1; m < full; m++) {
+			len = subset_ranks(ranks, itslen, m, sub);
+			exact[m] = fpt_itemset_count_ranks(fp, sub, len);
+		}
+	else if (!fp->cache)
+		tree_lattice(fp, ranks, itslen, exact);
+	else if (cached_lattice(fp, ranks, itslen, exact, cached)) {
+		tree_lattice(fp, ranks, itslen, exact);
+		for (m = 1; m < full; m++) {
+			if (cached[m])
+				continue;
+			len = subset_ranks(ranks, itslen, m, sub);
+			support_cache_insert(fp->cache, sub, len, exact[m]);
+		}
+	}
+
+	/* map back to the order of its */
+	for (m = 0; m < full; m++) {
+		for (i = 0, k = 0; i < itslen; i++)
+			if (m & (1 << i))
+				k |= bits[i];
+		sups[k] = exact[m];
+	}
+	sups[0] = fp->t;
+}
+
+/**
+ * Conditional pattern base: the transactions containing a prefix, restricted
+ * to a fixed set of items (slots) and without the items of the prefix.
+ */
+struct fpt_base {
+	/* number of slots */
+	int slots;
+	/* number of entries and room for them */
+	size_t n;
+	size_t sp;
+	/* number of transactions of each entry */
+	int *cnt;
+	/* entry i is items[off[i]] .. items[off[i + 1] - 1], sorted slots */
+	size_t *off;
+	int *items;
+	/* room for items */
+	size_t isp;
+};
+
+static struct fpt_base *base_new(int slots, size_t n, size_t items)
+{
+	struct fpt_base *b = calloc(1, sizeof(*b));
+
+	b->slots = slots;
+	b->sp = n ? n : 1;
+	b->isp = items ? items : 1;
+	b->cnt = calloc(b->sp, sizeof(b->cnt[0]));
+	b->off = calloc(b->sp + 1, sizeof(b->off[0]));
+	b->items = calloc(b->isp, sizeof(b->items[0]));
+	return b;
+}
+
+/* append an entry made of len sorted slots */
+static void base_add(struct fpt_base *b, const int *its, size_t len, int cnt)
+{
+	if (b->n == b->sp) {
+		b->sp *= 2;
+		b->cnt = realloc(b->cnt, b->sp * sizeof(b->cnt[0]));
+		b->off = realloc(b->off, (b->sp + 1) * sizeof(b->off[0]));
+	}
+	while (b->off[b->n] + len > b->isp) {
+		b->isp *= 2;
+		b->items = realloc(b->items, b->isp * sizeof(b->items[0]));
+	}
+
+	memcpy(b->items + b->off[b->n], its, len * sizeof(its[0]));
+	b->cnt[b->n] = cnt;
+	b->off[b->n + 1] = b->off[b->n] + len;
+	b->n++;
+}
+
+/* append the slots found on a path, given from the leaf up */
+static void base_add_path(struct fpt_base *b, int *path, int len, int cnt)
+{
+	int i, j, t;
+
+	if (!len || cnt <= 0)
+		return;
+	for (i = 1; i < len; i++) {
+		t = path[i];
+		for (j = i; j > 0 && path[j - 1] > t; j--)
+			path[j] = path[j - 1];
+		path[j] = t;
+	}
+	base_add(b, path, len, cnt);
+}
+
+/* order of the entries of base by length, then by items */
+static int base_entry_cmp(const void *a, const void *b, void *arg)
+{
+	const struct fpt_base *base = arg;
+	size_t ia = *(const size_t *)a, ib = *(const size_t *)b;
+	size_t la = base->off[ia + 1] - base->off[ia];
+	size_t lb = base->off[ib + 1] - base->off[ib];
+
+	if (la != lb)
+		return la < lb ? -1 : 1;
+	return memcmp(base->items + base->off[ia], base->items + base->off[ib],
+			la * sizeof(base->items[0]));
+}
+
+/* merge equal entries, summing their counts */
+static struct fpt_base *base_merge(struct fpt_base *b)
+{
+	size_t *ix = calloc(b->n ? b->n : 1, sizeof(ix[0])), i, j;
+	struct fpt_base *ret;
+	int cnt;
+
+	for (i = 0; i < b->n; i++)
+		ix[i] = i;
+	qsort_r(ix, b->n, sizeof(ix[0]), base_entry_cmp, b);
+
+	ret = base_new(b->slots, b->n, b->off[b->n]);
+	for (i = 0; i < b->n; i = j) {
+		cnt = b->cnt[ix[i]];
+		for (j = i + 1; j < b->n &&
+				!base_entry_cmp(&ix[i], &ix[j], b); j++)
+			cnt += b->cnt[ix[j]];
+		base_add(ret, b->items + b->off[ix[i]],
+				b->off[ix[i] + 1] - b->off[ix[i]], cnt);
+	}
+
+	fpt_base_free(b);
+	free(ix);
+	return ret;
+}
+
+struct fpt_base *fpt_project(const struct fptree *fp, const int *ranks, int n)
+{
+	const struct fpt_flat *flat = fp->flat;
+	int *slot, *path, len, i, end;
+	struct fptree_node *p, *q;
+	struct fpt_base *b;
+	uint32_t d, a;
+	size_t r;
+
+	slot = calloc(fp->n, sizeof(slot[0]));
+	for (r = 0; r < fp->n; r++)
+		slot[r] = -1;
+	for (i = 0; i < n; i++)
+		slot[ranks[i]] = i;
+	path = calloc(n ? n : 1, sizeof(path[0]));
+	b = base_new(n, 0, 0);
+
+	/*
+	 * One entry per node ending some transactions, made of the slots on
+	 * the path to it. A node ends the part of its count not passed to its
+	 * children. Equal entries are merged at the end.
+	 */
+	if (flat) {
+		int *ends = calloc(flat->nodes, sizeof(ends[0]));
+
+		for (d = 1; d < flat->nodes; d++) {
+			ends[d] += flat->cnt[d];
+			ends[flat->parent[d]] -= flat->cnt[d];
+		}
+		for (d = 1; d < flat->nodes; d++) {
+			if (ends[d] <= 0)
+				continue;
+			for (len = 0, a = d; a; a = flat->parent[a])
+				if (slot[flat->rank[a]] >= 0)
+					path[len++] = slot[flat->rank[a]];
+			base_add_path(b, path, len, ends[d]);
+		}
+		free(ends);
+	} else for (r = 0; r < fp->n; r++)
+		for (p = fp->table[r].fst; p; p = p->next) {
+			end = p->cnt;
+			for (i = 0; i < p->num_children; i++)
+				end -= p->children[i]->cnt;
+			for (len = 0, q = p; q->parent; q = q->parent)
+				if (slot[fp->table[q->val - 1].rpi] >= 0)
+					path[len++] = slot[fp->table[q->val - 1].rpi];
+			base_add_path(b, path, len, end);
+			if (p == fp->table[r].lst)
+				break;
+		}
+
+	free(path);
+	free(slot);
+	return base_merge(b);
+}
+
+struct fpt_base *fpt_base_project(const struct fpt_base *b, int s)
+{
+	struct fpt_base *ret = base_new(b->slots, 0, 0);
+	const int *it, *at;
+	size_t i, k, len;
+	int *dst;
+
+	for (i = 0; i < b->n; i++) {
+		it = b->items + b->off[i];
+		len = b->off[i + 1] - b->off[i];
+		at = bsearch(&s, it, len, sizeof(s), int_cmp);
+		/* entries made only of s do not count any other slot */
+		if (!at || len == 1)
+			continue;
+
+		/* copy the entry, then drop s from the copy */
+		k = at - it;
+		base_add(ret, it, len, b->cnt[i]);
+		dst = ret->items + ret->off[ret->n - 1] + k;
+		memmove(dst, dst + 1, (len - k - 1) * sizeof(dst[0]));
+		ret->off[ret->n]--;
+	}
+
+	return ret;
+}
+
+void fpt_base_count(const struct fpt_base *b, int *counts)
+{
+	size_t i, j;
+
+	memset(counts, 0, b->slots * sizeof(counts[0]));
+	for (i = 0; i < b->n; i++)
+		for (j = b->off[i]; j < b->off[i + 1]; j++)
+			counts[b->items[j]] += b->cnt[i];
+}
+
+void fpt_base_free(struct fpt_base *b)
+{
+	free(b->cnt);
+	free(b->off);
+	free(b->items);
+	free(b);
+}
+
+void fpt_build_vertical(struct fptree *fp, size_t ni)
+{
+	const struct fpt_flat *flat = fp->flat;
+	uint32_t *start, *cursor, i, p;
+
+	if (!flat)
+		die("The vertical index needs a frozen tree");
+
+	/* every node covers a range of the transactions of its parent */
+	start = calloc(flat->nodes, sizeof(start[0]));
+	cursor = calloc(flat->nodes, sizeof(cursor[0]));
+	for (i = 1; i < flat->nodes; i++) {
+		p = flat->parent[i];
+		start[i] = cursor[i] = cursor[p];
+		cursor[p] += flat->cnt[i];
+	}
+
+	fp->vert = build_vertical(cursor[0], min(ni, fp->n), flat->chain,
+			start, flat->cnt);
+	vertical_print_stats(fp->vert);
+
+	free(start);
+	free(cursor);
+}
+
+void fpt_enable_cache(struct fptree *fp, size_t bytes)
+{
+	if (fp->cache)
+		free_support_cache(fp->cache);
+	fp->cache = init_support_cache(bytes);
+}
+
+void fpt_share_cache(const struct fptree *fp, int shared)
+{
+	if (fp->cache)
+		support_cache_share(fp->cache, shared);
+}
+
+void fpt_print_cache_stats(const struct fptree *fp)
+{
+	if (fp->cache)
+		support_cache_print_stats(fp->cache);
 }
@@ -4,8 +4,12 @@
 #ifndef _FP_H
 #define _FP_H
 
+struct arena;
 struct table;
 struct fptree_node;
+struct fpt_flat;
+struct support_cache;
+struct vertical;
 
 /**
  * A fp-tree structure.
@@ -21,12 +25,59 @@ struct fptree {
 	struct table *table;
 	/* root of the tree, opaque */
 	struct fptree_node *tree;
+	/* storage for the nodes of the tree, opaque */
+	struct arena *arena;
+	/* flattened read-only tree, replacing the previous two, opaque */
+	struct fpt_flat *flat;
+	/* cache of itemset supports, NULL if disabled, opaque */
+	struct support_cache *cache;
+	/* tidsets of the most frequent items, NULL if disabled, opaque */
+	struct vertical *vert;
 };
 
 /**
- * Read a transaction file and construct a fp-tree from it.
+ * Allocate the nodes of the trees built after this call from memory backed
+ * by transparent huge pages. Off unless built with FP_HUGEPAGES=1.
  */
-void fpt_read_from_file(const char *fname, struct fptree *fp);
+void fpt_use_hugepages(int on);
+
+/**
+ * Read a transaction file and construct a fp-tree from it. Text files are
+ * parsed using nthreads threads, which also build the tree in shards when
+ * each of them gets at least FP_SHARD_MIN transactions. Snapshot files
+ * written by fpt_save_snapshot are mapped read-only instead, giving an
+ * already frozen tree.
+ */
+void fpt_read_from_file(const char *fname, size_t nthreads,
+		struct fptree *fp);
+
+/**
+ * Save a frozen tree to a snapshot file. Processes reading the same snapshot
+ * share its memory.
+ */
+void fpt_save_snapshot(const struct fptree *fp, const char *fname);
+
+/**
+ * Append the transactions of a file to the tree, thawing a frozen tree
+ * first. Items keep their ranks, new items being ranked last, unless the
+ * fraction of items whose rank changes by support exceeds tolerance. Then
+ * the tree is rebuilt with the new ranks. Not possible once a cache or a
+ * vertical index is enabled.
+ */
+void fpt_append_file(struct fptree *fp, const char *fname, size_t nthreads,
+		double tolerance);
+
+/**
+ * Rebuild a tree which is not frozen with the items ranked by their current
+ * support, if the drift of the order exceeds tolerance.
+ */
+void fpt_rebalance(struct fptree *fp, double tolerance);
+
+/**
+ * Convert the tree to a compact read-only layout used for counting. The tree
+ * cannot be modified afterwards.
+ */
+void fpt_freeze(struct fptree *fp);
 
 /**
  * Cleanup the data structures used in a fp-tree.
@@ -36,9 +87,119 @@ void fpt_cleanup(const struct fptree *fp);
 int fpt_height(const struct fptree *fp);
 int fpt_nodes(const struct fptree *fp);
 
+/* longest itemset which can be counted */
+#define FPT_MAXLEN 7
+
 int fpt_item_count(const struct fptree *fp, int it);
 int fpt_itemset_count(const struct fptree *fp, const int *its, int itslen);
 
+/**
+ * Items are ranked by decreasing support when the tree is built. Rank 0 is
+ * the most frequent item.
+ */
+int fpt_item_rank(const struct fptree *fp, int it);
+int fpt_rank_item(const struct fptree *fp, int rank);
+
+/**
+ * Same as fpt_itemset_count, but the itemset is given as ranks sorted in
+ * increasing order. Does not allocate memory.
+ */
+int fpt_itemset_count_ranks(const struct fptree *fp, const int *ranks,
+		int len);
+
+/**
+ * Conditional pattern base of a prefix: the transactions containing it,
+ * restricted to a set of items and without those of the prefix. Items are
+ * given as slots, the indices of their ranks in the set.
+ */
+struct fpt_base;
+
+/**
+ * Base of the empty prefix, for the n items of the given ranks.
+ */
+struct fpt_base *fpt_project(const struct fptree *fp, const int *ranks, int n);
+/**
+ * Base of the prefix of b extended with the item of slot s.
+ */
+struct fpt_base *fpt_base_project(const struct fpt_base *b, int s);
+/**
+ * Supports of the prefix of b extended with each slot, in a single scan.
+ */
+void fpt_base_count(const struct fpt_base *b, int *counts);
+void fpt_base_free(struct fpt_base *b);
+
+/**
+ * Supports of the itemsets made of a prefix and each of the candidates, all
+ * given as ranks. The prefix is sorted in increasing order and contains none
+ * of the candidates. On a frozen tree the candidates are counted together,
+ * walking the chain of the last item of the prefix only once.
+ */
+void fpt_itemset_count_batch(const struct fptree *fp, const int *prefix,
+		int plen, const int *cands, int ncands, int *counts);
+
+/**
+ * Compute the supports of all subsets of its in one pass over the tree. The
+ * support of the subset made of the items its[j] with bit j set in mask is
+ * stored in sups[mask], which has 1 << itslen entries. Items must be valid
+ * and distinct, at most FPT_MAXLEN of them. Like fpt_itemset_count, uses the
+ * tidsets if all items have one, and the support cache if enabled.
+ */
+void fpt_itemset_lattice(const struct fptree *fp, const int *its, int itslen,
+		int *sups);
+
+/**
+ * Index the transactions of the ni most frequent items, so that supports of
+ * itemsets made only of these items are computed by intersecting tidsets
+ * instead of walking the tree. Needs a frozen tree.
+ */
+void fpt_build_vertical(struct fptree *fp, size_t ni);
+
+/**
+ * Remember supports computed by fpt_itemset_count, using at most bytes of
+ * memory. Evicts least recently used itemsets when full. Enabling the cache
+ * again drops all cached supports.
+ */
+void fpt_enable_cache(struct fptree *fp, size_t bytes);
+/* make the cache safe to use while counting from several threads, nests */
+void fpt_share_cache(const struct fptree *fp, int shared);
+void fpt_print_cache_stats(const struct fptree *fp);
+
+/**
+ * A fp-tree over a sliding window of the last transactions of a stream. The
+ * tree is never frozen: transactions are added at one end of the window and
+ * removed at the other, decrementing node counts and unlinking nodes whose
+ * count reaches zero. Transactions are kept as item values, so the tree can
+ * be rebalanced at any time.
+ */
+struct fpt_window {
+	/* tree of the transactions in the window, fp.t of them */
+	struct fptree fp;
+	/* maximum number of transactions in the window */
+	size_t size;
+	/* ring of transactions in the window, oldest at head */
+	int **its;
+	int *len;
+	/* arrival time of each transaction */
+	long *stamp;
+	size_t head;
+};
+
+void fpt_window_init(struct fpt_window *w, size_t size);
+void fpt_window_cleanup(struct fpt_window *w);
+
+/**
+ * Add a transaction which arrived at stamp, removing the oldest one if the
+ * window is full. Drops the support cache of the tree.
+ */
+void fpt_window_add(struct fpt_window *w, const int *its, int len,
+		long stamp);
+
+/**
+ * Remove the transactions which arrived before stamp, returning how many
+ * were removed. Drops the support cache of the tree.
+ */
+size_t fpt_window_expire(struct fpt_window *w, long stamp);
+
 /** Debug printing. */
 void fpt_tree_print(const struct fptree *fp);
 void fpt_table_print(const struct fptree *fp);
@@ -1,17 +1,121 @@
 #include <gmp.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
 
 #include "globals.h"
+#include "vlog.h"
 
-void init_rng(long int seed, struct drand48_data *buffer)
+static uint64_t splitmix64(uint64_t x)
 {
-	struct timeval now;
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* xoshiro state from a 64 bit seed, as recommended by its authors */
+static void seed_xoshiro(uint64_t h, struct rng *rng)
+{
+	size_t i;
+
+	for (i = 0; i < 4; i++) {
+		h += 0x9e3779b97f4a7c15ULL;
+		rng->s[i] = splitmix64(h);
+	}
+}
 
-	gettimeofday(&now, NULL);
-	srand48_r(seed, buffer);
+void init_rng(long int seed, enum rng_engine engine, struct rng *rng)
+{
+	rng->engine = engine;
+	rng->pos = RNG_BLOCK;
+	if (engine == RNG_DRAND48)
+		srand48_r(seed, &rng->drand);
+	else
+		seed_xoshiro(seed, rng);
+}
+
+void init_rng_stream(long int seed, const int *path, size_t len,
+		enum rng_engine engine, struct rng *rng)
+{
+	unsigned short state[3];
+	uint64_t h = splitmix64(seed);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = splitmix64(h ^ (uint32_t)path[i]);
+
+	rng->engine = engine;
+	rng->pos = RNG_BLOCK;
+	if (engine == RNG_XOSHIRO) {
+		seed_xoshiro(h, rng);
+		return;
+	}
+
+	/* use all 48 bits of state, srand48_r would keep only 32 */
+	state[0] = h;
+	state[1] = h >> 16;
+	state[2] = h >> 32;
+	seed48_r(state, &rng->drand);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* xoshiro256** */
+static inline uint64_t xoshiro_next(uint64_t *s)
+{
+	uint64_t ret = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return ret;
+}
+
+/* fill u from the generator itself, skipping the block */
+static void generate_uniforms(struct rng *rng, double *u, size_t n)
+{
+	uint64_t s[4];
+	size_t i;
+
+	if (rng->engine == RNG_DRAND48) {
+		for (i = 0; i < n; i++)
+			drand48_r(&rng->drand, &u[i]);
+		return;
+	}
+
+	/* a local copy of the state stays in registers, 53 bits per double */
+	memcpy(s, rng->s, sizeof(s));
+	for (i = 0; i < n; i++)
+		u[i] = (xoshiro_next(s) >> 11) * 0x1.0p-53;
+	memcpy(rng->s, s, sizeof(s));
+}
+
+void rng_uniform_block(struct rng *rng, double *u, size_t n)
+{
+	size_t left = min(n, RNG_BLOCK - rng->pos);
+
+	/* uniforms generated ahead come first */
+	memcpy(u, rng->block + rng->pos, left * sizeof(u[0]));
+	rng->pos += left;
+	generate_uniforms(rng, u + left, n - left);
+}
+
+double rng_uniform(struct rng *rng)
+{
+	if (rng->pos == RNG_BLOCK) {
+		generate_uniforms(rng, rng->block, RNG_BLOCK);
+		rng->pos = 0;
+	}
+	return rng->block[rng->pos++];
 }
 
 int int_cmp(const void *a, const void *b)
@@ -42,11 +146,11 @@ int double_cmp_r(const void *a, const void *b)
 	return -double_cmp(a, b);
 }
 
-static double laplace(double lambda, struct drand48_data *buffer)
+static double laplace(double lambda, struct rng *rng)
 {
 	double rnd;
 
-	drand48_r(buffer, &rnd); /* rnd \in [0, 1)      */
+	rnd = rng_uniform(rng);  /* rnd \in [0, 1)      */
 	rnd = 0.5 - rnd;         /* rnd \in (-0.5, 0.5] */
 
 	if (signbit(rnd)) /* rnd < 0 */
@@ -55,9 +159,34 @@ static double laplace(double lambda, struct drand48_data *buffer)
 }
 
 double laplace_mechanism(double x, double eps, double sens,
-		struct drand48_data *buffer)
+		struct rng *rng)
 {
-	return x + laplace(sens/eps, buffer);
+	return x + laplace(sens/eps, rng);
+}
+
+void laplace_mechanism_batch(const double *x, double *y, size_t n,
+		double eps, double sens, struct rng *rng)
+{
+	double lambda = sens/eps, *u, *a;
+	size_t i;
+
+	/* one at a time with libm, as older runs did */
+	if (rng->engine == RNG_DRAND48) {
+		for (i = 0; i < n; i++)
+			y[i] = laplace_mechanism(x[i], eps, sens, rng);
+		return;
+	}
+
+	u = malloc(n * sizeof(u[0]));
+	a = malloc(n * sizeof(a[0]));
+	rng_uniform_block(rng, u, n);
+	for (i = 0; i < n; i++)
+		a[i] = 1 - 2 * fabs(0.5 - u[i]);
+	vlog(a, a, n);
+	for (i = 0; i < n; i++)
+		y[i] = x[i] + (u[i] > 0.5 ? lambda : -lambda) * a[i];
+	free(u);
+	free(a);
 }
 
 int bsearch_i(const void *key, const void *base, size_t nmemb, size_t size,
@@ -5,6 +5,9 @@
 #ifndef _GLOBALS_H
 #define _GLOBALS_H
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #define die(s, ...) \
 	do {\
 		fprintf(stderr, "[%s: %s %d] "s"\n", __FILE__, \
@@ -25,7 +28,28 @@
 		_a < _b ? _a : _b; \
 	})
 
-struct drand48_data;
+
+/* uniforms generated at once by a struct rng */
+#define RNG_BLOCK 64
+
+enum rng_engine {
+	/* xoshiro256**, the default */
+	RNG_XOSHIRO = 0,
+	/* drand48_r, to reproduce runs made before xoshiro was added */
+	RNG_DRAND48
+};
+
+/**
+ * Random number generator, seeded by init_rng or init_rng_stream.
+ */
+struct rng {
+	enum rng_engine engine;
+	uint64_t s[4];
+	struct drand48_data drand;
+	/* uniforms generated ahead, the next one is block[pos] */
+	double block[RNG_BLOCK];
+	size_t pos;
+};
 
 /* qsort functions for integer comparisons */
 int int_cmp(const void *a, const void *b);
@@ -33,11 +57,29 @@ int int_cmp_r(const void *a, const void *b);
 int double_cmp(const void *a, const void *b);
 int double_cmp_r(const void *a, const void *b);
 
-void init_rng(long int seed, struct drand48_data *buffer);
+void init_rng(long int seed, enum rng_engine engine, struct rng *rng);
+/**
+ * Start the random stream of a branch, identified by the path of items from
+ * the root. Streams of different paths are independent of each other.
+ */
+void init_rng_stream(long int seed, const int *path, size_t len,
+		enum rng_engine engine, struct rng *rng);
+
+/* uniform in [0, 1), taken from the block generated ahead */
+double rng_uniform(struct rng *rng);
+/* n uniforms in [0, 1), the same as n calls to rng_uniform */
+void rng_uniform_block(struct rng *rng, double *u, size_t n);
 
 /* Laplace mechanism */
 double laplace_mechanism(double x, double eps, double sens,
-		struct drand48_data *buffer);
+		struct rng *rng);
+/**
+ * y[i] = laplace_mechanism(x[i], eps, sens, rng) for i < n, with the logs
+ * computed by vlog. Only the drand48_r engine calls log from libm, keeping
+ * the values of older runs. x and y may be the same array.
+ */
+void laplace_mechanism_batch(const double *x, double *y, size_t n,
+		double eps, double sens, struct rng *rng);
 
 /* version of bsearch which returns the rightmost insertion index
  * (the first index for which the element is at least equal to the key)
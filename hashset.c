@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "globals.h"
+#include "hashset.h"
+
+#define INITIALSZ 64
+/* grow once more than half of the slots are used */
+#define MAXLOAD 2
+
+struct hashset {
+	/* power of two slots, 0 for empty ones */
+	uint64_t *keys;
+	size_t sp;
+	size_t sz;
+};
+
+struct hashset *init_hashset()
+{
+	struct hashset *ret = calloc(1, sizeof(*ret));
+	ret->sp = INITIALSZ;
+	ret->keys = calloc(ret->sp, sizeof(ret->keys[0]));
+	return ret;
+}
+
+void free_hashset(struct hashset *s)
+{
+	free(s->keys);
+	free(s);
+}
+
+static inline size_t hash_slot(uint64_t key, size_t sp)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key & (sp - 1);
+}
+
+/* slot holding key, or the empty one where it would go */
+static inline size_t find_slot(const uint64_t *keys, size_t sp, uint64_t key)
+{
+	size_t i = hash_slot(key, sp);
+
+	while (keys[i] && keys[i] != key)
+		i = (i + 1) & (sp - 1);
+	return i;
+}
+
+static void grow(struct hashset *s)
+{
+	uint64_t *keys = calloc(2 * s->sp, sizeof(keys[0]));
+	size_t i;
+
+	for (i = 0; i < s->sp; i++)
+		if (s->keys[i])
+			keys[find_slot(keys, 2 * s->sp, s->keys[i])] = s->keys[i];
+	free(s->keys);
+	s->keys = keys;
+	s->sp *= 2;
+}
+
+int hashset_insert(struct hashset *s, uint64_t key)
+{
+	size_t i = find_slot(s->keys, s->sp, key);
+
+	if (s->keys[i])
+		return 1;
+
+	s->keys[i] = key;
+	if (++s->sz * MAXLOAD > s->sp)
+		grow(s);
+	return 0;
+}
+
+int hashset_contains(const struct hashset *s, uint64_t key)
+{
+	return s->keys[find_slot(s->keys, s->sp, key)] != 0;
+}
+
+size_t hashset_size(const struct hashset *s)
+{
+	return s->sz;
+}
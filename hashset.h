@@ -0,0 +1,22 @@
+/**
+ * Open-addressing set of non-zero 64-bit keys.
+ */
+#ifndef _HASHSET_H
+#define _HASHSET_H
+
+#include <stdint.h>
+
+struct hashset;
+
+struct hashset *init_hashset();
+void free_hashset(struct hashset *s);
+
+/**
+ * Add key to the set. Returns 1 if it was already there, 0 otherwise.
+ */
+int hashset_insert(struct hashset *s, uint64_t key);
+int hashset_contains(const struct hashset *s, uint64_t key);
+
+size_t hashset_size(const struct hashset *s);
+
+#endif
@@ -36,6 +36,15 @@ void histogram_register(struct histogram *h, double val)
 		}
 }
 
+void histogram_merge(struct histogram *h, const struct histogram *o)
+{
+	int i;
+
+	h->total += o->total;
+	for (i = 0; i < c_num_values; i++)
+		h->values[i] += o->values[i];
+}
+
 size_t histogram_get_bin_c(const struct histogram *h, int bin)
 {
 	size_t ret = 0;
@@ -9,6 +9,8 @@ struct histogram;
 struct histogram *init_histogram();
 
 void histogram_register(struct histogram *h, double val);
+/* add the values registered in o to h */
+void histogram_merge(struct histogram *h, const struct histogram *o);
 
 size_t histogram_get_bin_c(const struct histogram *h, int bin);
 size_t histogram_get_bin(const struct histogram *h, int bin);
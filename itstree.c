@@ -108,6 +108,34 @@ int search_its_private(const struct itstree_node *itst, const int *its,
 	return search_its_private(p->iptr, its+1, sz-1);
 }
 
+/* deepest itemset visited by itstree_for_each_private */
+#define MAXDEPTH 32
+static void do_for_each(const struct itstree_node *itst, int *path,
+		size_t len, void (*fun)(const int *its, size_t sz, void *arg),
+		void *arg)
+{
+	size_t i;
+
+	if (itst->dpseen)
+		fun(path, len, arg);
+	if (itst->sz && len == MAXDEPTH)
+		die("Itemset too long: more than %d items", MAXDEPTH);
+
+	for (i = 0; i < itst->sz; i++) {
+		path[len] = itst->children[i].item;
+		do_for_each(itst->children[i].iptr, path, len + 1, fun, arg);
+	}
+}
+
+void itstree_for_each_private(const struct itstree_node *itst,
+		void (*fun)(const int *its, size_t sz, void *arg), void *arg)
+{
+	int path[MAXDEPTH] = {0};
+
+	do_for_each(itst, path, 0, fun, arg);
+}
+#undef MAXDEPTH
+
 void free_itstree(struct itstree_node *itst)
 {
 	size_t i;
@@ -16,6 +16,11 @@ void record_its(struct itstree_node *itst, const int *its, size_t sz,
 
 int search_its_private(const struct itstree_node *itst, const int *its,
 		size_t sz);
+/**
+ * Call fun on each itemset recorded with record_its_private.
+ */
+void itstree_for_each_private(const struct itstree_node *itst,
+		void (*fun)(const int *its, size_t sz, void *arg), void *arg);
 
 void save_its(const struct itstree_node *itst, const char *fname,
 		size_t lmax, size_t ni);
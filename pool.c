@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "globals.h"
+#include "pool.h"
+
+#define INITIALSZ 16
+
+struct deque {
+	void **tasks;
+	/* tasks left are tasks[head] .. tasks[tail - 1] */
+	size_t head;
+	size_t tail;
+	size_t sp;
+	pthread_mutex_t lock;
+};
+
+struct pool {
+	struct deque *queues;
+	size_t nthreads;
+	void (*fun)(void *arg, size_t worker);
+	/* queue receiving the next submitted task */
+	size_t next;
+	/* statistics */
+	size_t tasks;
+	size_t steals;
+};
+
+struct worker {
+	struct pool *p;
+	size_t id;
+};
+
+struct pool *init_pool(size_t nthreads, void (*fun)(void *arg, size_t worker))
+{
+	struct pool *ret = calloc(1, sizeof(*ret));
+	size_t i;
+
+	ret->nthreads = nthreads ? nthreads : 1;
+	ret->fun = fun;
+	ret->queues = calloc(ret->nthreads, sizeof(ret->queues[0]));
+	for (i = 0; i < ret->nthreads; i++) {
+		ret->queues[i].sp = INITIALSZ;
+		ret->queues[i].tasks = calloc(INITIALSZ,
+				sizeof(ret->queues[i].tasks[0]));
+		pthread_mutex_init(&ret->queues[i].lock, NULL);
+	}
+	return ret;
+}
+
+void free_pool(struct pool *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->nthreads; i++) {
+		pthread_mutex_destroy(&p->queues[i].lock);
+		free(p->queues[i].tasks);
+	}
+	free(p->queues);
+	free(p);
+}
+
+void pool_submit(struct pool *p, void *arg)
+{
+	struct deque *q = &p->queues[p->next];
+
+	if (q->tail == q->sp) {
+		q->sp *= 2;
+		q->tasks = realloc(q->tasks, q->sp * sizeof(q->tasks[0]));
+	}
+	q->tasks[q->tail++] = arg;
+	p->next = (p->next + 1) % p->nthreads;
+	p->tasks++;
+}
+
+/* newest task of the worker's own queue */
+static void *pop_back(struct deque *q)
+{
+	void *ret = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail)
+		ret = q->tasks[--q->tail];
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+/* oldest task of another queue, usually the largest left */
+static void *pop_front(struct deque *q)
+{
+	void *ret = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail)
+		ret = q->tasks[q->head++];
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct pool *p = w->p;
+	size_t i;
+	void *t;
+
+	for (;;) {
+		t = pop_back(&p->queues[w->id]);
+		/* tasks never queue new ones, all queues empty means done */
+		for (i = 1; !t && i < p->nthreads; i++) {
+			t = pop_front(&p->queues[(w->id + i) % p->nthreads]);
+			if (t)
+				__atomic_add_fetch(&p->steals, 1, __ATOMIC_RELAXED);
+		}
+		if (!t)
+			break;
+		p->fun(t, w->id);
+	}
+
+	return NULL;
+}
+
+void pool_run(struct pool *p)
+{
+	struct worker *w = calloc(p->nthreads, sizeof(w[0]));
+	pthread_t *th = calloc(p->nthreads, sizeof(th[0]));
+	size_t i;
+
+	for (i = 0; i < p->nthreads; i++) {
+		w[i].p = p;
+		w[i].id = i;
+	}
+	for (i = 1; i < p->nthreads; i++)
+		if (pthread_create(&th[i], NULL, pool_worker, &w[i]))
+			die("Unable to start worker thread %lu", i);
+	pool_worker(&w[0]);
+	for (i = 1; i < p->nthreads; i++)
+		pthread_join(th[i], NULL);
+
+	for (i = 0; i < p->nthreads; i++)
+		p->queues[i].head = p->queues[i].tail = 0;
+	free(w);
+	free(th);
+}
+
+size_t pool_tasks(const struct pool *p)
+{
+	return p->tasks;
+}
+
+size_t pool_steals(const struct pool *p)
+{
+	return p->steals;
+}
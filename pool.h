@@ -0,0 +1,33 @@
+/**
+ * Work-stealing pool of threads running independent tasks.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+struct pool;
+
+/**
+ * Create a pool of nthreads workers. Each task is run as fun(arg, worker),
+ * where worker is the index of the thread running it, in [0, nthreads).
+ */
+struct pool *init_pool(size_t nthreads, void (*fun)(void *arg, size_t worker));
+void free_pool(struct pool *p);
+
+/**
+ * Queue a task. Tasks are spread round-robin over the queues of the workers
+ * and cannot be submitted while the pool runs.
+ */
+void pool_submit(struct pool *p, void *arg);
+
+/**
+ * Run all queued tasks and wait for them. Each worker takes tasks from the
+ * back of its own queue and, once that is empty, steals from the front of the
+ * queues of the others. The calling thread is worker 0.
+ */
+void pool_run(struct pool *p);
+
+/* statistics */
+size_t pool_tasks(const struct pool *p);
+size_t pool_steals(const struct pool *p);
+
+#endif
@@ -43,23 +43,19 @@ static size_t ic_search(const struct item_count *ic, size_t n, int x)
 static void generate_rules_from_itemset(const int *AB, size_t ab_length,
 		const struct fptree *fp, struct itstree_node *itst)
 {
-	size_t i, j, max, a_length, rc30, rc50, rc70;
+	size_t i, max, rc30, rc50, rc70;
 	int *cf = calloc(ab_length, sizeof(cf[0]));
-	int *A = calloc(ab_length, sizeof(A[0]));
-	int sup_ab, sup_a;
+	int *sups;
+	int sup_ab;
 	double c;
 
 	max = (1 << ab_length) - 1;
+	sups = calloc(max + 1, sizeof(sups[0]));
+	fpt_itemset_lattice(fp, AB, ab_length, sups);
 	rc30 = rc50 = rc70 = 0;
-	sup_ab = fpt_itemset_count(fp, AB, ab_length);
+	sup_ab = sups[max];
 	for (i = 1; i < max; i++) {
-		a_length = 0;
-		for (j = 0; j < ab_length; j++)
-			if (i & (1 << j))
-				A[a_length++] = AB[j];
-
-		sup_a = fpt_itemset_count(fp, A, a_length);
-		c = div_or_zero(sup_ab, sup_a);
+		c = div_or_zero(sup_ab, sups[i]);
 		if (c > .3) rc30++;
 		if (c > .5) rc50++;
 		if (c > .7) rc70++;
@@ -71,7 +67,7 @@ static void generate_rules_from_itemset(const int *AB, size_t ab_length,
 	record_its(itst, cf, ab_length, rc30, rc50, rc70);
 
 	free(cf);
-	free(A);
+	free(sups);
 }
 
 static void generate(const struct fptree *fp, const struct item_count *ic,
@@ -1,9 +1,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "globals.h"
 #include "rs.h"
+#include "vlog.h"
 
 struct reservoir_item {
 	const void *item_ptr;
@@ -12,10 +14,23 @@ struct reservoir_item {
 	double v;
 };
 
+/**
+ * Once full, its is a max-heap on v: the root is the next item replaced.
+ * Iteration sorts it by increasing v.
+ */
 struct reservoir {
 	struct reservoir_item *its;
 	size_t actual;
 	size_t sz;
+	/* its is sorted for iteration instead of being a heap */
+	int sorted;
+#if RS_EXPJ
+	/* log of the weight still to skip before the next item enters */
+	double logjump;
+#endif
+	/* storage of items of itemsz bytes each, if not cloned */
+	char *slots;
+	size_t itemsz;
 	/* utility functions */
 	void (*print_fun)(const void *it);
 	void *(*clone_fun)(const void *it);
@@ -42,27 +57,42 @@ struct reservoir *init_reservoir(size_t sz,
 	return ret;
 }
 
+struct reservoir *init_reservoir_fixed(size_t sz, size_t itemsz,
+		void (*print_fun)(const void *it))
+{
+	struct reservoir *ret = init_reservoir(sz, print_fun, NULL, NULL);
+	ret->slots = calloc(sz ? sz : 1, itemsz);
+	ret->itemsz = itemsz;
+	return ret;
+}
+
 void free_reservoir(struct reservoir *r)
 {
 	size_t i;
 
-	for (i = 0;  i < r->actual; i++)
-		r->free_fun((void*)r->its[i].item_ptr);
+	if (r->free_fun)
+		for (i = 0;  i < r->actual; i++)
+			r->free_fun((void*)r->its[i].item_ptr);
+	free(r->slots);
 	free(r->its);
 	free(r);
 }
 
-static inline double generate_random_uniform(struct drand48_data *randbuffer)
+static inline double generate_random_uniform(struct rng *rng)
 {
-	double u;
-	drand48_r(randbuffer, &u);
-	return u;
+	return rng_uniform(rng);
 }
 
 static void store_item_at(struct reservoir *r, size_t ix, const void *it,
 		double w, double u, double v)
 {
-	r->its[ix].item_ptr = r->clone_fun(it/*, nmemb, sz*/);
+	if (r->slots) {
+		/* a replaced item leaves its slot to the new one */
+		if (ix == r->actual)
+			r->its[ix].item_ptr = r->slots + ix * r->itemsz;
+		memcpy((void *)r->its[ix].item_ptr, it, r->itemsz);
+	} else
+		r->its[ix].item_ptr = r->clone_fun(it/*, nmemb, sz*/);
 	r->its[ix].w = w;
 	r->its[ix].u = u;
 	r->its[ix].v = v;
@@ -74,6 +104,30 @@ static int reservoir_cmp(const void *a, const void *b)
 	return double_cmp(&ra->v, &rb->v);
 }
 
+static void sift_down(struct reservoir_item *its, size_t n, size_t i)
+{
+	struct reservoir_item t = its[i];
+	size_t c;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && its[c + 1].v > its[c].v)
+			c++;
+		if (its[c].v <= t.v)
+			break;
+		its[i] = its[c];
+	}
+	its[i] = t;
+}
+
+static void heapify(struct reservoir *r)
+{
+	size_t i;
+
+	for (i = r->actual / 2; i > 0; i--)
+		sift_down(r->its, r->actual, i - 1);
+	r->sorted = 0;
+}
+
 #if PRINT_RS_TRACE || DETAILED_RS_TRACE
 static void print_reservoir(struct reservoir *r)
 {
@@ -98,48 +152,157 @@ static void store_item(struct reservoir *r, const void *it,
 	printf(", w=%5.2lf, u=%5.2lf, v=%5.2lf\n", w, u, v);
 #endif
 
-	/* not a full reservoir yet */
+	/* not a full reservoir yet, kept in insertion order */
 	if (r->actual < r->sz) {
 		store_item_at(r, r->actual, it, w, u, v);
-		r->actual++;
-		goto end;
-	}
+		if (++r->actual == r->sz)
+			heapify(r);
+	} else {
+		if (r->sorted)
+			heapify(r);
 
-	/* no changes to the reservoir */
-	if (v >= r->its[r->sz - 1].v)
-		return;
+		/* no changes to the reservoir */
+		if (v >= r->its[0].v)
+			return;
 
-	r->free_fun((void*)r->its[r->sz-1].item_ptr);
-	store_item_at(r, r->sz - 1, it, w, u, v);
+		/* replace the root, the item with the largest key */
+		if (r->free_fun)
+			r->free_fun((void*)r->its[0].item_ptr);
+		store_item_at(r, 0, it, w, u, v);
+		sift_down(r->its, r->sz, 0);
+	}
 
-end:
-	if (r->actual == r->sz) {
-		qsort(r->its, r->sz, sizeof(r->its[0]), reservoir_cmp);
 #if PRINT_RS_TRACE || DETAILED_RS_TRACE
+	if (r->actual == r->sz)
 		print_reservoir(r);
 #endif
+}
+
+#if RS_EXPJ
+/**
+ * Weight to skip until the next item enters a full reservoir. With vmax the
+ * key of the root, an item of weight w stays out with probability
+ * exp(-w exp(vmax)), so the skipped weight is exponential with rate
+ * exp(vmax).
+ */
+static void draw_jump(struct reservoir *r, struct rng *rng)
+{
+	double u = generate_random_uniform(rng);
+	r->logjump = log(-log(u)) - r->its[0].v;
+}
+
+/**
+ * Exponential jumps (A-ExpJ) on the log weights: once the reservoir is full,
+ * draws are only made for the items entering it. The key of an entering
+ * item is drawn conditioned on being below the root.
+ */
+static void add_expj(struct reservoir *r, const void *it, double logw,
+		struct rng *rng)
+{
+	double u, p;
+
+	if (r->actual < r->sz) {
+		u = generate_random_uniform(rng);
+		store_item(r, it, logw, u, log(log(1/u)) - logw);
+		if (r->actual == r->sz)
+			draw_jump(r, rng);
+		return;
 	}
+
+	if (r->sorted)
+		heapify(r);
+	if (logw < r->logjump) {
+		/* item skipped */
+		r->logjump += log1p(-exp(logw - r->logjump));
+		return;
+	}
+
+	/* probability of entering, an exponential below the root */
+	p = -expm1(-exp(logw + r->its[0].v));
+	u = generate_random_uniform(rng);
+	store_item(r, it, logw, u, log(-log1p(-u * p)) - logw);
+	draw_jump(r, rng);
 }
+#endif
 
 void add_to_reservoir(struct reservoir *r, const void *it,
-		double w, struct drand48_data *randbuffer)
+		double w, struct rng *rng)
 {
-	double u = generate_random_uniform(randbuffer);
+#if RS_EXPJ
+	add_expj(r, it, log(w), rng);
+#else
+	double u = generate_random_uniform(rng);
 	double v = -log(u)/w;
 	store_item(r, it, w, u, v);
+#endif
 }
 
 void add_to_reservoir_log(struct reservoir *r, const void *it,
-		double logw, struct drand48_data *randbuffer)
+		double logw, struct rng *rng)
 {
-	double u = generate_random_uniform(randbuffer);
+#if RS_EXPJ
+	add_expj(r, it, logw, rng);
+#else
+	double u = generate_random_uniform(rng);
 	double v = log(log(1/u)) - logw;
 	store_item(r, it, logw, u, v);
+#endif
+}
+
+#if !RS_EXPJ
+/* keys log(log(1/u)) - logw of n items */
+static void compute_keys_log(const double *logw, const double *u, double *v,
+		size_t n, const struct rng *rng)
+{
+	size_t i;
+
+	/* libm, as older runs did */
+	if (rng->engine == RNG_DRAND48) {
+		for (i = 0; i < n; i++)
+			v[i] = log(log(1/u[i])) - logw[i];
+		return;
+	}
+
+	vlog(u, v, n);
+	for (i = 0; i < n; i++)
+		v[i] = -v[i];
+	vlog(v, v, n);
+	for (i = 0; i < n; i++)
+		v[i] -= logw[i];
+}
+#endif
+
+void add_batch_to_reservoir_log(struct reservoir *r, const void *its,
+		size_t itemsz, const double *logw, size_t n, struct rng *rng)
+{
+	const char *it = its;
+	size_t i;
+#if RS_EXPJ
+	/* draws are made for entering items only, no key is known ahead */
+	for (i = 0; i < n; i++)
+		add_expj(r, it + i * itemsz, logw[i], rng);
+#else
+	double *u = malloc(n * sizeof(u[0]));
+	double *v = malloc(n * sizeof(v[0]));
+
+	rng_uniform_block(rng, u, n);
+	compute_keys_log(logw, u, v, n, rng);
+	for (i = 0; i < n; i++)
+		store_item(r, it + i * itemsz, logw[i], u[i], v[i]);
+	free(u);
+	free(v);
+#endif
 }
 
 struct reservoir_iterator *init_reservoir_iterator(struct reservoir *r)
 {
 	struct reservoir_iterator *ret = calloc(1, sizeof(*ret));
+
+	/* a full reservoir is iterated by increasing key */
+	if (r->actual == r->sz && !r->sorted) {
+		qsort(r->its, r->actual, sizeof(r->its[0]), reservoir_cmp);
+		r->sorted = 1;
+	}
 	ret->reservoir = r;
 	ret->current_pos = 0;
 	return ret;
@@ -13,25 +13,42 @@
 #ifndef DETAILED_RS_TRACE
 #define DETAILED_RS_TRACE 0
 #endif
+/* skip the candidates which cannot enter a full reservoir (A-ExpJ) */
+#ifndef RS_EXPJ
+#define RS_EXPJ 0
+#endif
 
 struct reservoir;
 struct reservoir_iterator;
-struct drand48_data;
+struct rng;
 
 /* Notice one extra parameter when tracing the reservoir */
 struct reservoir *init_reservoir(size_t sz,
 		void (*print_fun)(const void *it),
 		void *(*clone_fun)(const void *it),
 		void (*free_fun)(void *it));
+/**
+ * Reservoir of items of itemsz bytes, copied in storage allocated upfront
+ * instead of being cloned and freed one by one.
+ */
+struct reservoir *init_reservoir_fixed(size_t sz, size_t itemsz,
+		void (*print_fun)(const void *it));
 void free_reservoir(struct reservoir *r);
 
 /**
  * Add item to reservoir using weight (log weight).
  */
 void add_to_reservoir(struct reservoir *r, const void *it,
-		double w, struct drand48_data *randbuffer);
+		double w, struct rng *rng);
 void add_to_reservoir_log(struct reservoir *r, const void *it,
-		double logw, struct drand48_data *randbuffer);
+		double logw, struct rng *rng);
+/**
+ * Add n items of itemsz bytes stored contiguously at its, drawing the same
+ * random numbers as n calls to add_to_reservoir_log. The keys of all items
+ * are computed together, before any of them is selected.
+ */
+void add_batch_to_reservoir_log(struct reservoir *r, const void *its,
+		size_t itemsz, const double *logw, size_t n, struct rng *rng);
 
 struct reservoir_iterator *init_reservoir_iterator(struct reservoir *r);
 void free_reservoir_iterator(struct reservoir_iterator *ri);
@@ -0,0 +1,207 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "supcache.h"
+
+/* entries per set, the least recently used one is evicted */
+#define WAYS 4
+/* locks of a shared cache, each guarding every STRIPES-th set */
+#define STRIPES 64
+
+struct cache_entry {
+	int key[SUPCACHE_MAXLEN];
+	int count;
+	/* last access, 0 for empty entries */
+	uint32_t stamp;
+	uint32_t len;
+};
+
+struct support_cache {
+	struct cache_entry *entries;
+	size_t sets;
+	uint32_t clock;
+	/* NULL unless the cache is shared between threads */
+	pthread_mutex_t *locks;
+	/* calls to support_cache_share(c, 1) not yet undone */
+	size_t sharers;
+	/* statistics */
+	size_t hits, misses, evictions;
+};
+
+struct support_cache *init_support_cache(size_t bytes)
+{
+	size_t sets = 1;
+	struct support_cache *ret;
+
+	if (bytes < WAYS * sizeof(struct cache_entry))
+		return NULL;
+	while (2 * sets * WAYS * sizeof(struct cache_entry) <= bytes)
+		sets *= 2;
+
+	ret = calloc(1, sizeof(*ret));
+	ret->sets = sets;
+	ret->entries = calloc(sets * WAYS, sizeof(ret->entries[0]));
+	return ret;
+}
+
+static void destroy_locks(struct support_cache *c)
+{
+	size_t i;
+
+	if (!c->locks)
+		return;
+	for (i = 0; i < STRIPES; i++)
+		pthread_mutex_destroy(&c->locks[i]);
+	free(c->locks);
+	c->locks = NULL;
+}
+
+void free_support_cache(struct support_cache *c)
+{
+	destroy_locks(c);
+	free(c->entries);
+	free(c);
+}
+
+static inline size_t cache_set(const struct support_cache *c,
+		const int *key, size_t len)
+{
+	uint64_t h = len;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint32_t)key[i];
+		h *= 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+	return (h & (c->sets - 1)) * WAYS;
+}
+
+static inline int cache_match(const struct cache_entry *e,
+		const int *key, size_t len)
+{
+	return e->stamp && e->len == len &&
+		!memcmp(e->key, key, len * sizeof(key[0]));
+}
+
+void support_cache_share(struct support_cache *c, int shared)
+{
+	size_t i;
+
+	/* only the outermost calls, made by a single thread, touch the locks */
+	if (!shared) {
+		if (!__atomic_sub_fetch(&c->sharers, 1, __ATOMIC_ACQ_REL))
+			destroy_locks(c);
+		return;
+	}
+	if (__atomic_add_fetch(&c->sharers, 1, __ATOMIC_ACQ_REL) > 1)
+		return;
+	c->locks = calloc(STRIPES, sizeof(c->locks[0]));
+	for (i = 0; i < STRIPES; i++)
+		pthread_mutex_init(&c->locks[i], NULL);
+}
+
+static inline void cache_lock(struct support_cache *c, size_t set)
+{
+	if (c->locks)
+		pthread_mutex_lock(&c->locks[(set / WAYS) % STRIPES]);
+}
+
+static inline void cache_unlock(struct support_cache *c, size_t set)
+{
+	if (c->locks)
+		pthread_mutex_unlock(&c->locks[(set / WAYS) % STRIPES]);
+}
+
+static inline void cache_count(const struct support_cache *c, size_t *stat)
+{
+	if (c->locks)
+		__atomic_add_fetch(stat, 1, __ATOMIC_RELAXED);
+	else
+		(*stat)++;
+}
+
+/* keep stamps non-zero and increasing, reset all entries on overflow */
+static inline uint32_t cache_tick(struct support_cache *c)
+{
+	uint32_t t;
+	size_t i;
+
+	/* a shared cache cannot reset other sets, stamps just wrap around */
+	if (c->locks) {
+		t = __atomic_add_fetch(&c->clock, 1, __ATOMIC_RELAXED);
+		return t ? t : 1;
+	}
+
+	if (++c->clock == UINT32_MAX) {
+		for (i = 0; i < c->sets * WAYS; i++)
+			c->entries[i].stamp = !!c->entries[i].stamp;
+		c->clock = 2;
+	}
+	return c->clock;
+}
+
+int support_cache_lookup(struct support_cache *c, const int *key, size_t len,
+		int *count)
+{
+	struct cache_entry *e;
+	size_t i, set;
+
+	if (len > SUPCACHE_MAXLEN)
+		return 0;
+
+	set = cache_set(c, key, len);
+	e = c->entries + set;
+	cache_lock(c, set);
+	for (i = 0; i < WAYS; i++)
+		if (cache_match(&e[i], key, len)) {
+			e[i].stamp = cache_tick(c);
+			*count = e[i].count;
+			cache_unlock(c, set);
+			cache_count(c, &c->hits);
+			return 1;
+		}
+	cache_unlock(c, set);
+
+	cache_count(c, &c->misses);
+	return 0;
+}
+
+void support_cache_insert(struct support_cache *c, const int *key, size_t len,
+		int count)
+{
+	struct cache_entry *e, *v;
+	size_t i, set;
+
+	if (len > SUPCACHE_MAXLEN)
+		return;
+
+	set = cache_set(c, key, len);
+	e = c->entries + set;
+	cache_lock(c, set);
+	v = &e[0];
+	for (i = 1; i < WAYS; i++)
+		if (e[i].stamp < v->stamp)
+			v = &e[i];
+
+	if (v->stamp)
+		cache_count(c, &c->evictions);
+	memcpy(v->key, key, len * sizeof(key[0]));
+	v->len = len;
+	v->count = count;
+	v->stamp = cache_tick(c);
+	cache_unlock(c, set);
+}
+
+void support_cache_print_stats(const struct support_cache *c)
+{
+	printf("Support cache: %lu hits, %lu misses (%5.2lf%% hit rate), "
+			"%lu evictions, %lu bytes\n", c->hits, c->misses,
+			100 * div_or_zero(c->hits, c->hits + c->misses),
+			c->evictions,
+			c->sets * WAYS * sizeof(struct cache_entry));
+}
@@ -0,0 +1,38 @@
+/**
+ * Bounded cache of itemset supports.
+ */
+#ifndef _SUPCACHE_H
+#define _SUPCACHE_H
+
+/* longest itemset which can be cached */
+#define SUPCACHE_MAXLEN 7
+
+struct support_cache;
+
+/**
+ * Create a cache using at most bytes of memory (rounded down to a power of
+ * two number of sets). Returns NULL if bytes is too small for any set.
+ */
+struct support_cache *init_support_cache(size_t bytes);
+void free_support_cache(struct support_cache *c);
+
+/**
+ * Guard the cache with locks while it is used by several threads. Calls
+ * nest: the locks are dropped once each support_cache_share(c, 1) has been
+ * undone by a support_cache_share(c, 0). The outermost pair must not race
+ * with other uses of the cache.
+ */
+void support_cache_share(struct support_cache *c, int shared);
+
+/**
+ * Keys are canonical itemsets: ranks sorted in increasing order.
+ * Lookup returns 1 and fills count on a hit, 0 on a miss.
+ */
+int support_cache_lookup(struct support_cache *c, const int *key, size_t len,
+		int *count);
+void support_cache_insert(struct support_cache *c, const int *key, size_t len,
+		int count);
+
+void support_cache_print_stats(const struct support_cache *c);
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Converts a transaction file to the binary transaction format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb.h"
+
+/* Command line arguments */
+static struct {
+	/* filename containing the transactions */
+	char *tfname;
+	/* filename for the binary output */
+	char *ofname;
+} args;
+
+static void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s TFILE OFILE\n", prg);
+	exit(EXIT_FAILURE);
+}
+
+static void parse_arguments(int argc, char **argv)
+{
+	int i;
+
+	printf("Called with: argc=%d\n", argc);
+	for (i = 0; i < argc; i++)
+		printf("%s ", argv[i]);
+	printf("\n");
+
+	if (argc != 3)
+		usage(argv[0]);
+	args.tfname = strdup(argv[1]);
+	args.ofname = strdup(argv[2]);
+}
+
+int main(int argc, char **argv)
+{
+	struct tdb db;
+
+	parse_arguments(argc, argv);
+
+	printf("Parsing transactions ... ");
+	fflush(stdout);
+	tdb_load(args.tfname, 1, &db);
+	printf("OK\n");
+	printf("items: %lu, transactions: %lu, entries: %lu\n",
+			db.n, db.t, db.offsets[db.t]);
+
+	printf("Saving binary transactions to %s ... ", args.ofname);
+	fflush(stdout);
+	tdb_save(&db, args.ofname);
+	printf("OK\n");
+
+	tdb_cleanup(&db);
+	free(args.tfname);
+	free(args.ofname);
+
+	return 0;
+}
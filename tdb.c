@@ -0,0 +1,672 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "globals.h"
+#include "tdb.h"
+
+#define MICROSECONDS 1000000L
+#define INITIAL_SIZE 100
+
+/* read zstd compressed files, needs libzstd */
+#ifndef HAVE_ZSTD
+#define HAVE_ZSTD 0
+#endif
+/* decompressed blocks in flight between the two threads, and their size */
+#define TDB_STREAM_BLOCKS 4
+#define TDB_STREAM_BLOCK (1UL << 20)
+
+#define is_digit(c) ((unsigned)((c) - '0') < 10)
+
+static inline void tdb_push_item(struct tdb *db, size_t x,
+		size_t *isz, size_t *isp, size_t *csz)
+{
+	size_t i;
+
+	if (x >= *csz) {
+		i = *csz;
+		while (x >= *csz)
+			*csz *= 2;
+		db->counts = realloc(db->counts, *csz * sizeof(db->counts[0]));
+		for (; i < *csz; i++)
+			db->counts[i] = 0;
+	}
+	db->counts[x]++;
+	if (x > db->n)
+		db->n = x;
+
+	/* item 0 is never part of a transaction */
+	if (!x)
+		return;
+
+	if (*isz == *isp) {
+		*isp *= 2;
+		db->items = realloc(db->items, *isp * sizeof(db->items[0]));
+	}
+	db->items[(*isz)++] = x;
+}
+
+/**
+ * State of a tokenizer fed the input one block at a time. Items on a last
+ * line which is not terminated by a newline are counted but do not form a
+ * transaction.
+ */
+struct tdb_parser {
+	struct tdb *db;
+	size_t isz, isp, csz, osp;
+	/* item split between two blocks */
+	size_t x;
+	int in_item;
+};
+
+static void tdb_parse_init(struct tdb_parser *ps, struct tdb *db)
+{
+	ps->db = db;
+	ps->isz = 0;
+	ps->isp = ps->csz = ps->osp = INITIAL_SIZE;
+	ps->x = 0;
+	ps->in_item = 0;
+
+	db->t = db->n = 0;
+	db->counts = calloc(ps->csz, sizeof(db->counts[0]));
+	db->offsets = calloc(ps->osp, sizeof(db->offsets[0]));
+	db->items = calloc(ps->isp, sizeof(db->items[0]));
+}
+
+static void tdb_parse_block(struct tdb_parser *ps, const char *p,
+		const char *end)
+{
+	struct tdb *db = ps->db;
+	size_t x = ps->x;
+
+	if (ps->in_item) {
+		while (p < end && is_digit(*p))
+			x = x * 10 + (*p++ - '0');
+		if (p == end) {
+			ps->x = x;
+			return;
+		}
+		tdb_push_item(db, x, &ps->isz, &ps->isp, &ps->csz);
+		ps->in_item = 0;
+	}
+
+	while (p < end) {
+		if (is_digit(*p)) {
+			x = 0;
+			do {
+				x = x * 10 + (*p++ - '0');
+			} while (p < end && is_digit(*p));
+			if (p == end) {
+				ps->x = x;
+				ps->in_item = 1;
+				return;
+			}
+			tdb_push_item(db, x, &ps->isz, &ps->isp, &ps->csz);
+			continue;
+		}
+
+		if (*p++ != '\n')
+			continue;
+
+		if (db->t + 2 > ps->osp) {
+			ps->osp *= 2;
+			db->offsets = realloc(db->offsets,
+					ps->osp * sizeof(db->offsets[0]));
+		}
+		db->offsets[++db->t] = ps->isz;
+	}
+}
+
+static void tdb_parse_finish(struct tdb_parser *ps)
+{
+	if (ps->in_item)
+		tdb_push_item(ps->db, ps->x, &ps->isz, &ps->isp, &ps->csz);
+}
+
+/**
+ * Tokenize the entire buffer in one pass.
+ */
+static void tdb_parse(const char *p, const char *end, struct tdb *db)
+{
+	struct tdb_parser ps;
+
+	tdb_parse_init(&ps, db);
+	tdb_parse_block(&ps, p, end);
+	tdb_parse_finish(&ps);
+}
+
+/**
+ * Binary format: header, supports[n], offsets[t + 1], order[n], items[nnz].
+ * The 8-byte arrays come first so every array is naturally aligned in the
+ * mapping. Integers are stored in host byte order.
+ */
+#define TDB_MAGIC "DPHCSR1"
+
+struct tdb_header {
+	char magic[8];
+	uint64_t n;
+	uint64_t t;
+	uint64_t nnz;
+};
+
+/**
+ * Whether the arrays described by h fill the rest of a file of the given
+ * size exactly. Each array is checked against the space left, so that
+ * corrupt counts cannot overflow the computation.
+ */
+static int tdb_binary_fits(const struct tdb_header *h, size_t bytes)
+{
+	size_t left = bytes - sizeof(*h);
+
+	/* ranks and item values are int */
+	if (h->n > INT_MAX ||
+			h->n > left / (sizeof(uint64_t) + sizeof(int32_t)))
+		return 0;
+	left -= h->n * (sizeof(uint64_t) + sizeof(int32_t));
+	if (h->t >= left / sizeof(uint64_t))
+		return 0;
+	left -= (h->t + 1) * sizeof(uint64_t);
+	return left % sizeof(int32_t) == 0 && h->nnz == left / sizeof(int32_t);
+}
+
+/* check the arrays of a mapped file before the tree is built from them */
+static void tdb_check_binary(const char *fname, const struct tdb *db,
+		size_t nnz)
+{
+	size_t i;
+
+	if (db->offsets[0] != 0 || db->offsets[db->t] != nnz)
+		die("Corrupt transaction offsets in %s", fname);
+	for (i = 0; i < db->t; i++)
+		if (db->offsets[i + 1] < db->offsets[i])
+			die("Corrupt transaction offsets in %s", fname);
+	for (i = 0; i < db->n; i++)
+		if (db->order[i] < 1 || (size_t)db->order[i] > db->n)
+			die("Corrupt item order in %s", fname);
+	for (i = 0; i < nnz; i++)
+		if (db->items[i] < 0 || (size_t)db->items[i] >= db->n)
+			die("Corrupt item rank in %s", fname);
+}
+
+static void tdb_map_binary(const char *fname, char *buf, struct tdb *db)
+{
+	const struct tdb_header *h = (const struct tdb_header *)buf;
+
+	if (!tdb_binary_fits(h, db->bytes))
+		die("Corrupt binary transaction file %s", fname);
+
+	db->map = buf;
+	db->n = h->n;
+	db->t = h->t;
+	db->counts = NULL;
+	buf += sizeof(*h);
+	db->supports = (size_t *)buf;
+	buf += db->n * sizeof(db->supports[0]);
+	db->offsets = (size_t *)buf;
+	buf += (db->t + 1) * sizeof(db->offsets[0]);
+	db->order = (int *)buf;
+	buf += db->n * sizeof(db->order[0]);
+	db->items = (int *)buf;
+	tdb_check_binary(fname, db, h->nnz);
+}
+
+struct rank_entry {
+	int val;
+	size_t cnt;
+};
+
+/* decreasing support, ties broken by item value */
+static int rank_cmp(const void *a, const void *b)
+{
+	const struct rank_entry *ra = a, *rb = b;
+
+	if (ra->cnt != rb->cnt)
+		return ra->cnt < rb->cnt ? 1 : -1;
+	return ra->val - rb->val;
+}
+
+/**
+ * Order items by decreasing support, filling order and supports. Returns the
+ * rank of each item value, to be freed by the caller.
+ */
+static int *tdb_order(struct tdb *db)
+{
+	struct rank_entry *re = calloc(db->n, sizeof(re[0]));
+	int *rank = calloc(db->n + 1, sizeof(rank[0]));
+	size_t i;
+
+	for (i = 0; i < db->n; i++) {
+		re[i].val = i + 1;
+		re[i].cnt = db->counts[i + 1];
+	}
+	qsort(re, db->n, sizeof(re[0]), rank_cmp);
+
+	db->order = calloc(db->n, sizeof(db->order[0]));
+	db->supports = calloc(db->n, sizeof(db->supports[0]));
+	for (i = 0; i < db->n; i++) {
+		db->order[i] = re[i].val;
+		db->supports[i] = re[i].cnt;
+		rank[re[i].val] = i;
+	}
+
+	free(re);
+	return rank;
+}
+
+/* replace items of transactions [from, to) with their sorted ranks */
+static void tdb_rank_transactions(struct tdb *db, const int *rank,
+		size_t from, size_t to)
+{
+	size_t i, j;
+
+	for (i = from; i < to; i++) {
+		for (j = db->offsets[i]; j < db->offsets[i + 1]; j++)
+			db->items[j] = rank[db->items[j]];
+		qsort(db->items + db->offsets[i],
+				db->offsets[i + 1] - db->offsets[i],
+				sizeof(db->items[0]), int_cmp);
+	}
+}
+
+static void tdb_parse_serial(const char *buf, size_t len, struct tdb *db)
+{
+	int *rank;
+
+	tdb_parse(buf, buf + len, db);
+	rank = tdb_order(db);
+	tdb_rank_transactions(db, rank, 0, db->t);
+	free(rank);
+}
+
+/**
+ * A chunk of the input, parsed by one thread into a private database and
+ * then copied and ranked into its slice of the merged one.
+ */
+struct tdb_chunk {
+	const char *p;
+	const char *end;
+	struct tdb db;
+	/* first transaction and item of the chunk in the merged database */
+	size_t base_t;
+	size_t base_i;
+	/* shared between all chunks, for the second phase */
+	struct tdb *out;
+	const int *rank;
+	pthread_t tid;
+};
+
+static void *tdb_parse_chunk(void *arg)
+{
+	struct tdb_chunk *c = arg;
+
+	tdb_parse(c->p, c->end, &c->db);
+	return NULL;
+}
+
+static void *tdb_rank_chunk(void *arg)
+{
+	struct tdb_chunk *c = arg;
+	struct tdb *out = c->out;
+	size_t i;
+
+	memcpy(out->items + c->base_i, c->db.items,
+			c->db.offsets[c->db.t] * sizeof(out->items[0]));
+	/* offsets at chunk boundaries are set before the threads start */
+	for (i = 1; i < c->db.t; i++)
+		out->offsets[c->base_t + i] = c->base_i + c->db.offsets[i];
+	tdb_rank_transactions(out, c->rank, c->base_t, c->base_t + c->db.t);
+
+	free(c->db.counts);
+	free(c->db.offsets);
+	free(c->db.items);
+	return NULL;
+}
+
+static void tdb_run_chunks(struct tdb_chunk *cs, size_t nthreads,
+		void *(*fun)(void *))
+{
+	size_t i;
+
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&cs[i].tid, NULL, fun, &cs[i]))
+			die("Unable to start parser thread");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(cs[i].tid, NULL);
+}
+
+/**
+ * Split the input at newline boundaries, count items in each chunk in
+ * parallel, merge the counts and then rank the chunks in parallel. The
+ * merged database is the same as the one tdb_parse_serial builds.
+ */
+static void tdb_parse_parallel(const char *buf, size_t len, size_t nthreads,
+		struct tdb *db)
+{
+	struct tdb_chunk *cs = calloc(nthreads, sizeof(cs[0]));
+	const char *p = buf, *q, *end = buf + len;
+	size_t i, j, nnz = 0;
+	int *rank;
+
+	for (i = 0; i < nthreads; i++) {
+		cs[i].p = p;
+		q = buf + len / nthreads * (i + 1);
+		if (i == nthreads - 1)
+			q = end;
+		else if (q <= p)
+			q = p;
+		else {
+			q = memchr(q - 1, '\n', end - q + 1);
+			q = q ? q + 1 : end;
+		}
+		cs[i].end = p = q;
+	}
+	tdb_run_chunks(cs, nthreads, tdb_parse_chunk);
+
+	db->t = db->n = 0;
+	for (i = 0; i < nthreads; i++) {
+		cs[i].base_t = db->t;
+		cs[i].base_i = nnz;
+		db->t += cs[i].db.t;
+		nnz += cs[i].db.offsets[cs[i].db.t];
+		db->n = max(db->n, cs[i].db.n);
+	}
+
+	db->counts = calloc(db->n + 1, sizeof(db->counts[0]));
+	for (i = 0; i < nthreads; i++)
+		for (j = 0; j <= cs[i].db.n; j++)
+			db->counts[j] += cs[i].db.counts[j];
+	db->offsets = calloc(db->t + 1, sizeof(db->offsets[0]));
+	for (i = 0; i < nthreads; i++)
+		db->offsets[cs[i].base_t] = cs[i].base_i;
+	db->offsets[db->t] = nnz;
+	db->items = calloc(nnz + 1, sizeof(db->items[0]));
+
+	rank = tdb_order(db);
+	for (i = 0; i < nthreads; i++) {
+		cs[i].out = db;
+		cs[i].rank = rank;
+	}
+	tdb_run_chunks(cs, nthreads, tdb_rank_chunk);
+
+	free(rank);
+	free(cs);
+}
+
+#define GZIP_MAGIC "\x1f\x8b"
+#define ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+
+/**
+ * Compressed input, decompressed by one thread into a ring of blocks which
+ * are parsed by another.
+ */
+struct tdb_stream {
+	/* compressed input */
+	const char *in;
+	size_t len;
+	const char *fname;
+	int zstd;
+	/* ring of decompressed blocks */
+	char *blocks[TDB_STREAM_BLOCKS];
+	size_t sizes[TDB_STREAM_BLOCKS];
+	size_t head, count;
+	/* set once the last block is in the ring */
+	int done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* wait for a free block */
+static char *tdb_stream_next(struct tdb_stream *s)
+{
+	char *ret;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->count == TDB_STREAM_BLOCKS)
+		pthread_cond_wait(&s->cond, &s->lock);
+	ret = s->blocks[(s->head + s->count) % TDB_STREAM_BLOCKS];
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
+
+/* hand a filled block to the parser */
+static void tdb_stream_push(struct tdb_stream *s, size_t sz, int done)
+{
+	pthread_mutex_lock(&s->lock);
+	s->sizes[(s->head + s->count) % TDB_STREAM_BLOCKS] = sz;
+	s->count++;
+	s->done = done;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* gzip files may have several members, each is a separate stream */
+static void tdb_inflate(struct tdb_stream *s)
+{
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 32) != Z_OK)
+		die("Unable to initialize zlib");
+	zs.next_in = (unsigned char *)s->in;
+	zs.avail_in = s->len;
+
+	do {
+		zs.next_out = (unsigned char *)tdb_stream_next(s);
+		zs.avail_out = TDB_STREAM_BLOCK;
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END && zs.avail_in) {
+			inflateReset(&zs);
+			ret = Z_OK;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			die("Corrupt compressed file %s", s->fname);
+		if (ret == Z_OK && !zs.avail_in && zs.avail_out)
+			die("Truncated compressed file %s", s->fname);
+		tdb_stream_push(s, TDB_STREAM_BLOCK - zs.avail_out,
+				ret == Z_STREAM_END);
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&zs);
+}
+
+#if HAVE_ZSTD
+static void tdb_unzstd(struct tdb_stream *s)
+{
+	ZSTD_DCtx *dc = ZSTD_createDCtx();
+	ZSTD_inBuffer zin = { s->in, s->len, 0 };
+	ZSTD_outBuffer zout;
+	size_t ret = 0;
+
+	if (!dc)
+		die("Unable to initialize zstd");
+
+	do {
+		zout.dst = tdb_stream_next(s);
+		zout.size = TDB_STREAM_BLOCK;
+		zout.pos = 0;
+		ret = ZSTD_decompressStream(dc, &zout, &zin);
+		if (ZSTD_isError(ret))
+			die("Corrupt compressed file %s", s->fname);
+		if (ret && zin.pos == zin.size && zout.pos < zout.size)
+			die("Truncated compressed file %s", s->fname);
+		tdb_stream_push(s, zout.pos, !ret && zin.pos == zin.size);
+	} while (ret || zin.pos < zin.size);
+
+	ZSTD_freeDCtx(dc);
+}
+#endif
+
+static void *tdb_decompress(void *arg)
+{
+	struct tdb_stream *s = arg;
+
+#if HAVE_ZSTD
+	if (s->zstd) {
+		tdb_unzstd(s);
+		return NULL;
+	}
+#endif
+	tdb_inflate(s);
+	return NULL;
+}
+
+/**
+ * Parse a compressed file in a single pass, parsing each block while the
+ * next ones are decompressed. Returns the size of the decompressed input.
+ */
+static size_t tdb_parse_compressed(const char *fname, const char *buf,
+		size_t len, int zstd, struct tdb *db)
+{
+	struct tdb_stream s;
+	struct tdb_parser ps;
+	size_t i, bytes = 0;
+	pthread_t tid;
+	int *rank;
+
+	if (zstd && !HAVE_ZSTD)
+		die("Reading zstd file %s needs a build with HAVE_ZSTD", fname);
+
+	memset(&s, 0, sizeof(s));
+	s.in = buf;
+	s.len = len;
+	s.fname = fname;
+	s.zstd = zstd;
+	for (i = 0; i < TDB_STREAM_BLOCKS; i++)
+		s.blocks[i] = malloc(TDB_STREAM_BLOCK);
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	if (pthread_create(&tid, NULL, tdb_decompress, &s))
+		die("Unable to start decompression thread");
+
+	tdb_parse_init(&ps, db);
+	for (;;) {
+		pthread_mutex_lock(&s.lock);
+		while (!s.count && !s.done)
+			pthread_cond_wait(&s.cond, &s.lock);
+		if (!s.count) {
+			pthread_mutex_unlock(&s.lock);
+			break;
+		}
+		pthread_mutex_unlock(&s.lock);
+
+		/* the head block is not touched until it is released */
+		tdb_parse_block(&ps, s.blocks[s.head],
+				s.blocks[s.head] + s.sizes[s.head]);
+		bytes += s.sizes[s.head];
+
+		pthread_mutex_lock(&s.lock);
+		s.head = (s.head + 1) % TDB_STREAM_BLOCKS;
+		s.count--;
+		pthread_cond_broadcast(&s.cond);
+		pthread_mutex_unlock(&s.lock);
+	}
+	tdb_parse_finish(&ps);
+	pthread_join(tid, NULL);
+
+	rank = tdb_order(db);
+	tdb_rank_transactions(db, rank, 0, db->t);
+
+	free(rank);
+	for (i = 0; i < TDB_STREAM_BLOCKS; i++)
+		free(s.blocks[i]);
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.cond);
+	return bytes;
+}
+
+void tdb_load(const char *fname, size_t nthreads, struct tdb *db)
+{
+	struct timeval starttime, endtime;
+	struct stat st;
+	size_t len;
+	char *buf;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		die("Invalid transaction filename %s", fname);
+	if (fstat(fd, &st) < 0)
+		die("Unable to stat %s", fname);
+
+	db->bytes = len = st.st_size;
+	db->map = NULL;
+	buf = NULL;
+	if (len) {
+		buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED)
+			die("Unable to map %s", fname);
+		madvise(buf, len, MADV_SEQUENTIAL);
+	}
+
+	gettimeofday(&starttime, NULL);
+	if (len >= sizeof(struct tdb_header) &&
+			!memcmp(buf, TDB_MAGIC, sizeof(TDB_MAGIC)))
+		tdb_map_binary(fname, buf, db);
+	else if (len >= 2 && !memcmp(buf, GZIP_MAGIC, 2))
+		db->bytes = tdb_parse_compressed(fname, buf, len, 0, db);
+	else if (len >= 4 && !memcmp(buf, ZSTD_MAGIC, 4))
+		db->bytes = tdb_parse_compressed(fname, buf, len, 1, db);
+	else if (nthreads > 1)
+		tdb_parse_parallel(buf, len, nthreads, db);
+	else
+		tdb_parse_serial(buf, len, db);
+	gettimeofday(&endtime, NULL);
+	db->time = (endtime.tv_sec - starttime.tv_sec) +
+		(0.0 + endtime.tv_usec - starttime.tv_usec) / MICROSECONDS;
+
+	if (buf && !db->map)
+		munmap(buf, len);
+	close(fd);
+}
+
+void tdb_save(const struct tdb *db, const char *fname)
+{
+	struct tdb_header h;
+	FILE *f;
+
+	f = fopen(fname, "w");
+	if (!f)
+		die("Unable to save file %s", fname);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TDB_MAGIC, sizeof(TDB_MAGIC));
+	h.n = db->n;
+	h.t = db->t;
+	h.nnz = db->offsets[db->t];
+
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(db->supports, sizeof(db->supports[0]), db->n, f);
+	fwrite(db->offsets, sizeof(db->offsets[0]), db->t + 1, f);
+	fwrite(db->order, sizeof(db->order[0]), db->n, f);
+	fwrite(db->items, sizeof(db->items[0]), h.nnz, f);
+
+	if (fclose(f))
+		die("Unable to write file %s", fname);
+}
+
+void tdb_cleanup(struct tdb *db)
+{
+	if (db->map) {
+		munmap(db->map, db->bytes);
+		return;
+	}
+
+	free(db->counts);
+	free(db->offsets);
+	free(db->items);
+	free(db->order);
+	free(db->supports);
+}
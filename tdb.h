@@ -0,0 +1,56 @@
+/**
+ * In-memory transaction database.
+ */
+#ifndef _TDB_H
+#define _TDB_H
+
+/**
+ * Transactions of a file, parsed in a single pass.
+ *
+ * Transaction i occupies items[offsets[i]] .. items[offsets[i + 1] - 1].
+ * Each item is stored as its rank in the header table (items sorted by
+ * decreasing support) and every transaction is sorted by rank.
+ */
+struct tdb {
+	/* number of items (largest item value seen) */
+	size_t n;
+	/* number of transactions */
+	size_t t;
+	/* support of each item, indexed by item value (text input only) */
+	size_t *counts;
+	/* start of each transaction in items, t + 1 entries */
+	size_t *offsets;
+	/* items of all transactions, in file order */
+	int *items;
+	/* item value of each rank, n entries */
+	int *order;
+	/* support of each rank, n entries */
+	size_t *supports;
+	/* size of the parsed input, in bytes */
+	size_t bytes;
+	/* time spent parsing, in seconds */
+	double time;
+	/* file mapping backing the arrays of a binary file, if any */
+	void *map;
+};
+
+/**
+ * Map a transaction file in memory and parse it. Both text files (one
+ * transaction per line) and binary files written by tdb_save are accepted.
+ * Text files are split in nthreads chunks parsed in parallel. Text files
+ * compressed with gzip (or zstd, if built with HAVE_ZSTD) are parsed in a
+ * single pass while being decompressed by another thread.
+ */
+void tdb_load(const char *fname, size_t nthreads, struct tdb *db);
+
+/**
+ * Save a transaction database in the binary format.
+ */
+void tdb_save(const struct tdb *db, const char *fname);
+
+/**
+ * Cleanup the data structures used in a transaction database.
+ */
+void tdb_cleanup(struct tdb *db);
+
+#endif
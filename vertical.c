@@ -0,0 +1,464 @@
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "vertical.h"
+
+/* longest itemset which can be counted */
+#define MAX_ITEMS 64
+
+enum container_type {
+	CT_BITMAP = 0,
+	CT_RUNS,
+	CT_ARRAY,
+	CT_TYPES
+};
+
+static const char *container_names[] = {"bitmap", "run", "array"};
+
+struct run {
+	uint32_t start;
+	uint32_t len;
+};
+
+struct tidset {
+	enum container_type type;
+	/* number of transactions in set */
+	uint32_t card;
+	/* number of runs or array entries */
+	uint32_t sz;
+	union {
+		uint64_t *words;
+		struct run *runs;
+		uint32_t *tids;
+	};
+};
+
+struct vertical {
+	/* number of transactions */
+	size_t t;
+	/* number of words in a bitmap */
+	size_t words;
+	/* number of items with a tidset */
+	size_t ni;
+	struct tidset *sets;
+	/* statistics */
+	size_t count[CT_TYPES];
+	size_t bytes[CT_TYPES];
+};
+
+/**
+ * Popcount of the AND of nb bitmaps over words [w0, w1), selected once
+ * according to the instruction set of the CPU.
+ */
+typedef size_t (*and_popcount_fun)(const uint64_t *const *bm, int nb,
+		size_t w0, size_t w1);
+static and_popcount_fun and_popcount;
+static const char *and_popcount_name;
+
+static size_t and_popcount_scalar(const uint64_t *const *bm, int nb,
+		size_t w0, size_t w1)
+{
+	size_t w, ret = 0;
+	uint64_t x;
+	int i;
+
+	for (w = w0; w < w1; w++) {
+		x = bm[0][w];
+		for (i = 1; i < nb; i++)
+			x &= bm[i][w];
+		ret += __builtin_popcountll(x);
+	}
+
+	return ret;
+}
+
+/* nibble lookup popcount, summed per 64-bit lane */
+__attribute__((target("avx2")))
+static size_t and_popcount_avx2(const uint64_t *const *bm, int nb,
+		size_t w0, size_t w1)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256(), x, lo, hi, cnt;
+	uint64_t lanes[4];
+	size_t w;
+	int i;
+
+	for (w = w0; w + 4 <= w1; w += 4) {
+		x = _mm256_loadu_si256((const __m256i *)(bm[0] + w));
+		for (i = 1; i < nb; i++)
+			x = _mm256_and_si256(x,
+				_mm256_loadu_si256((const __m256i *)(bm[i] + w)));
+		lo = _mm256_and_si256(x, low);
+		hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low);
+		cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+				_mm256_shuffle_epi8(lookup, hi));
+		acc = _mm256_add_epi64(acc,
+				_mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+		and_popcount_scalar(bm, nb, w, w1);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t and_popcount_avx512(const uint64_t *const *bm, int nb,
+		size_t w0, size_t w1)
+{
+	__m512i acc = _mm512_setzero_si512(), x;
+	size_t w;
+	int i;
+
+	for (w = w0; w + 8 <= w1; w += 8) {
+		x = _mm512_loadu_si512(bm[0] + w);
+		for (i = 1; i < nb; i++)
+			x = _mm512_and_si512(x, _mm512_loadu_si512(bm[i] + w));
+		acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+	}
+
+	return _mm512_reduce_add_epi64(acc) +
+		and_popcount_scalar(bm, nb, w, w1);
+}
+
+static void select_and_popcount(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512vpopcntdq")) {
+		and_popcount = and_popcount_avx512;
+		and_popcount_name = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		and_popcount = and_popcount_avx2;
+		and_popcount_name = "avx2";
+	} else {
+		and_popcount = and_popcount_scalar;
+		and_popcount_name = "scalar";
+	}
+}
+
+/* popcount of the AND of nb bitmaps over bits [lo, hi) */
+static size_t and_popcount_range(const uint64_t *const *bm, int nb,
+		size_t lo, size_t hi)
+{
+	size_t w0 = lo >> 6, w1 = hi >> 6, ret = 0;
+	uint64_t x, mask;
+	int i;
+
+	if (lo >= hi)
+		return 0;
+
+	mask = ~0ULL << (lo & 63);
+	if (w0 == w1) {
+		mask &= (1ULL << (hi & 63)) - 1;
+		x = mask;
+		for (i = 0; i < nb; i++)
+			x &= bm[i][w0];
+		return __builtin_popcountll(x);
+	}
+
+	x = mask;
+	for (i = 0; i < nb; i++)
+		x &= bm[i][w0];
+	ret += __builtin_popcountll(x);
+
+	ret += and_popcount(bm, nb, w0 + 1, w1);
+
+	if (hi & 63) {
+		x = (1ULL << (hi & 63)) - 1;
+		for (i = 0; i < nb; i++)
+			x &= bm[i][w1];
+		ret += __builtin_popcountll(x);
+	}
+
+	return ret;
+}
+
+static int run_cmp(const void *a, const void *b)
+{
+	const struct run *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	return 0;
+}
+
+/* sort runs and merge the overlapping or adjacent ones, returns new size */
+static uint32_t merge_runs(struct run *runs, uint32_t sz)
+{
+	uint32_t i, j = 0;
+
+	if (!sz)
+		return 0;
+
+	qsort(runs, sz, sizeof(runs[0]), run_cmp);
+	for (i = 1; i < sz; i++) {
+		if (runs[i].start <= runs[j].start + runs[j].len) {
+			runs[j].len = max(runs[j].start + runs[j].len,
+					runs[i].start + runs[i].len) -
+				runs[j].start;
+			continue;
+		}
+		runs[++j] = runs[i];
+	}
+
+	return j + 1;
+}
+
+static void build_tidset(struct vertical *v, struct tidset *ts,
+		struct run *runs, uint32_t sz)
+{
+	size_t bytes[CT_TYPES];
+	uint32_t i, j, k;
+
+	ts->sz = merge_runs(runs, sz);
+	ts->card = 0;
+	for (i = 0; i < ts->sz; i++)
+		ts->card += runs[i].len;
+
+	bytes[CT_BITMAP] = v->words * sizeof(uint64_t);
+	bytes[CT_RUNS] = ts->sz * sizeof(struct run);
+	bytes[CT_ARRAY] = ts->card * sizeof(uint32_t);
+
+	ts->type = CT_BITMAP;
+	if (bytes[CT_RUNS] < bytes[ts->type])
+		ts->type = CT_RUNS;
+	if (bytes[CT_ARRAY] < bytes[ts->type])
+		ts->type = CT_ARRAY;
+	v->count[ts->type]++;
+	v->bytes[ts->type] += bytes[ts->type];
+
+	switch (ts->type) {
+	case CT_BITMAP:
+		ts->words = calloc(v->words, sizeof(ts->words[0]));
+		for (i = 0; i < ts->sz; i++)
+			for (k = runs[i].start; k < runs[i].start + runs[i].len; k++)
+				ts->words[k >> 6] |= 1ULL << (k & 63);
+		break;
+	case CT_RUNS:
+		ts->runs = calloc(ts->sz, sizeof(ts->runs[0]));
+		memcpy(ts->runs, runs, ts->sz * sizeof(runs[0]));
+		break;
+	default:
+		ts->tids = calloc(ts->card, sizeof(ts->tids[0]));
+		for (i = 0, j = 0; i < ts->sz; i++)
+			for (k = runs[i].start; k < runs[i].start + runs[i].len; k++)
+				ts->tids[j++] = k;
+		ts->sz = ts->card;
+		break;
+	}
+}
+
+struct vertical *build_vertical(size_t t, size_t ni, const uint32_t *chain,
+		const uint32_t *start, const int32_t *cnt)
+{
+	struct vertical *v = calloc(1, sizeof(*v));
+	uint32_t i, sz, maxsz = 0;
+	struct run *runs;
+	size_t r;
+
+	if (!and_popcount)
+		select_and_popcount();
+
+	v->t = t;
+	v->words = (t + 63) / 64;
+	v->ni = ni;
+	v->sets = calloc(ni, sizeof(v->sets[0]));
+
+	for (r = 0; r < ni; r++)
+		maxsz = max(maxsz, chain[r + 1] - chain[r]);
+	runs = calloc(maxsz + 1, sizeof(runs[0]));
+
+	for (r = 0; r < ni; r++) {
+		sz = 0;
+		for (i = chain[r]; i < chain[r + 1]; i++) {
+			runs[sz].start = start[i];
+			runs[sz++].len = cnt[i];
+		}
+		build_tidset(v, &v->sets[r], runs, sz);
+	}
+
+	free(runs);
+	return v;
+}
+
+void free_vertical(struct vertical *v)
+{
+	size_t r;
+
+	for (r = 0; r < v->ni; r++)
+		free(v->sets[r].words); /* any member of the union */
+	free(v->sets);
+	free(v);
+}
+
+size_t vertical_items(const struct vertical *v)
+{
+	return v->ni;
+}
+
+/* intersect two sorted sets of runs into out, returns size */
+static uint32_t runs_and_runs(const struct run *a, uint32_t na,
+		const struct run *b, uint32_t nb, struct run *out)
+{
+	uint32_t i = 0, j = 0, k = 0, s, e;
+
+	while (i < na && j < nb) {
+		s = max(a[i].start, b[j].start);
+		e = min(a[i].start + a[i].len, b[j].start + b[j].len);
+		if (s < e) {
+			out[k].start = s;
+			out[k++].len = e - s;
+		}
+		if (a[i].start + a[i].len < b[j].start + b[j].len)
+			i++;
+		else
+			j++;
+	}
+
+	return k;
+}
+
+/* keep the tids of a which are inside the runs of b, returns size */
+static uint32_t array_and_runs(const uint32_t *a, uint32_t na,
+		const struct run *b, uint32_t nb, uint32_t *out)
+{
+	uint32_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j].start)
+			i++;
+		else if (a[i] >= b[j].start + b[j].len)
+			j++;
+		else
+			out[k++] = a[i++];
+	}
+
+	return k;
+}
+
+static uint32_t array_and_array(const uint32_t *a, uint32_t na,
+		const uint32_t *b, uint32_t nb, uint32_t *out)
+{
+	uint32_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			out[k++] = a[i++];
+			j++;
+		}
+	}
+
+	return k;
+}
+
+/**
+ * Intersect the run and array containers, smallest first, then count the
+ * result against the bitmaps.
+ */
+static int count_mixed(const struct tidset **others, int no,
+		const uint64_t *const *bm, int nb)
+{
+	uint32_t sz = others[0]->sz, ssz = 0, i;
+	enum container_type type = others[0]->type;
+	const void *cur = others[0]->runs;
+	void *buf[2] = {NULL, NULL};
+	int j, w = 0;
+	size_t ret = 0;
+
+	for (j = 1; j < no && sz; j++) {
+		/* a result is never larger than the two inputs combined */
+		if (!buf[0]) {
+			ssz = sz + others[j]->sz;
+			for (i = j + 1; i < (uint32_t)no; i++)
+				ssz += others[i]->sz;
+			buf[0] = calloc(ssz, sizeof(struct run));
+			buf[1] = calloc(ssz, sizeof(struct run));
+		}
+
+		if (type == CT_RUNS && others[j]->type == CT_RUNS)
+			sz = runs_and_runs(cur, sz, others[j]->runs,
+					others[j]->sz, buf[w]);
+		else if (type == CT_RUNS)
+			sz = array_and_runs(others[j]->tids, others[j]->sz,
+					cur, sz, buf[w]);
+		else if (others[j]->type == CT_RUNS)
+			sz = array_and_runs(cur, sz, others[j]->runs,
+					others[j]->sz, buf[w]);
+		else
+			sz = array_and_array(cur, sz, others[j]->tids,
+					others[j]->sz, buf[w]);
+		if (others[j]->type == CT_ARRAY)
+			type = CT_ARRAY;
+		cur = buf[w];
+		w = !w;
+	}
+
+	if (type == CT_RUNS) {
+		const struct run *runs = cur;
+		for (i = 0; i < sz; i++)
+			ret += nb ? and_popcount_range(bm, nb, runs[i].start,
+					runs[i].start + runs[i].len) : runs[i].len;
+	} else {
+		const uint32_t *tids = cur;
+		for (i = 0; i < sz; i++) {
+			for (j = 0; j < nb; j++)
+				if (!(bm[j][tids[i] >> 6] & (1ULL << (tids[i] & 63))))
+					break;
+			ret += j == nb;
+		}
+	}
+
+	free(buf[0]);
+	free(buf[1]);
+	return ret;
+}
+
+int vertical_count(const struct vertical *v, const int *ranks, size_t len)
+{
+	const struct tidset *others[MAX_ITEMS], *ts;
+	const uint64_t *bm[MAX_ITEMS];
+	int nb = 0, no = 0, j;
+	size_t k;
+
+	if (len > MAX_ITEMS)
+		die("Itemset too long for the vertical index: %lu", len);
+
+	for (k = 0; k < len; k++) {
+		ts = &v->sets[ranks[k]];
+		if (ts->type == CT_BITMAP) {
+			bm[nb++] = ts->words;
+			continue;
+		}
+		/* keep others sorted by cardinality */
+		for (j = no++; j > 0 && others[j - 1]->card > ts->card; j--)
+			others[j] = others[j - 1];
+		others[j] = ts;
+	}
+
+	if (!no)
+		return and_popcount(bm, nb, 0, v->words);
+	if (no == 1 && !nb)
+		return others[0]->card;
+
+	return count_mixed(others, no, bm, nb);
+}
+
+void vertical_print_stats(const struct vertical *v)
+{
+	int i;
+
+	printf("Vertical index: %lu items, %lu transactions, %s kernel\n",
+			v->ni, v->t, and_popcount_name);
+	for (i = 0; i < CT_TYPES; i++)
+		printf("\t%-6s containers: %8lu, %12lu bytes\n",
+				container_names[i], v->count[i], v->bytes[i]);
+}
@@ -0,0 +1,30 @@
+/**
+ * Vertical (transaction id set) representation of the most frequent items.
+ */
+#ifndef _VERTICAL_H
+#define _VERTICAL_H
+
+#include <stdint.h>
+
+struct vertical;
+
+/**
+ * Build the tidsets of the items of rank less than ni from a flattened tree
+ * holding t transactions. Node i of rank r (chain[r] <= i < chain[r + 1])
+ * covers transactions start[i] .. start[i] + cnt[i] - 1.
+ */
+struct vertical *build_vertical(size_t t, size_t ni, const uint32_t *chain,
+		const uint32_t *start, const int32_t *cnt);
+void free_vertical(struct vertical *v);
+
+/* number of items with a tidset (all ranks below this are indexed) */
+size_t vertical_items(const struct vertical *v);
+
+/**
+ * Support of an itemset given as ranks, all below vertical_items.
+ */
+int vertical_count(const struct vertical *v, const int *ranks, size_t len);
+
+void vertical_print_stats(const struct vertical *v);
+
+#endif
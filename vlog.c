@@ -0,0 +1,84 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "vlog.h"
+
+/* lanes of a vector, GCC splits them if wider than the registers */
+#define LANES 4
+
+typedef double vdouble __attribute__((vector_size(LANES * sizeof(double))));
+typedef int64_t vint __attribute__((vector_size(LANES * sizeof(int64_t))));
+typedef uint64_t vuint __attribute__((vector_size(LANES * sizeof(uint64_t))));
+
+/* fdlibm coefficients, log(1 + f) with |f| < sqrt(2) - 1 */
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define LG1 6.666666666666735130e-01
+#define LG2 3.999999999940941908e-01
+#define LG3 2.857142874366239149e-01
+#define LG4 2.222219843214978396e-01
+#define LG5 1.818357216161805012e-01
+#define LG6 1.531383769920937332e-01
+#define LG7 1.479819860511658591e-01
+
+/* high word of sqrt(2)/2 */
+#define SQRTH 0x3fe6a09e00000000ULL
+#define ONE 0x3ff0000000000000ULL
+/* 2^52, a biased exponent or'ed in its mantissa is converted by a subtraction */
+#define TWO52 0x4330000000000000ULL
+
+/**
+ * The algorithm of fdlibm: x = 2^k (1 + f) with 1 + f in [sqrt(2)/2,
+ * sqrt(2)), then log(1 + f) = 2s + s R(s^2) where s = f / (2 + f). Only
+ * valid for positive normal x. Only operations of SSE2 are used on the
+ * integer lanes, and vectors are passed by address, which keeps the ABI
+ * independent of the instruction set.
+ */
+static inline void vlog_lanes(vdouble *x)
+{
+	vuint ix = (vuint)*x;
+	vdouble f, hfsq, s, z, w, r, dk;
+
+	/* shift so that the exponent of 1 + f is 0 */
+	ix += ONE - SQRTH;
+	dk = (vdouble)((ix >> 52) | TWO52) - (0x1p52 + 0x3ff);
+	ix = (ix & 0x000fffffffffffffULL) + SQRTH;
+	f = (vdouble)ix - 1.0;
+
+	hfsq = 0.5 * f * f;
+	s = f / (2.0 + f);
+	z = s * s;
+	w = z * z;
+	r = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7))) +
+		w * (LG2 + w * (LG4 + w * LG6));
+	*x = s * (hfsq + r) + dk * LN2_LO - hfsq + f + dk * LN2_HI;
+}
+
+void vlog(const double *x, double *y, size_t n)
+{
+	vdouble v;
+	vint bad;
+	size_t i, j;
+
+	for (i = 0; i < n; i += LANES) {
+		if (n - i < LANES) {
+			/* pad the last vector with ones */
+			v = (vdouble){} + 1.0;
+			memcpy(&v, x + i, (n - i) * sizeof(double));
+		} else
+			memcpy(&v, x + i, sizeof(v));
+
+		bad = (v < DBL_MIN) | (v > DBL_MAX) | (v != v);
+		vlog_lanes(&v);
+		for (j = 0; j < LANES; j++)
+			if (bad[j])
+				v[j] = log(x[i + j]);
+
+		if (n - i < LANES)
+			memcpy(y + i, &v, (n - i) * sizeof(double));
+		else
+			memcpy(y + i, &v, sizeof(v));
+	}
+}
@@ -0,0 +1,16 @@
+/**
+ * Natural logarithm of arrays of doubles, several lanes at a time.
+ */
+#ifndef _VLOG_H
+#define _VLOG_H
+
+#include <stddef.h>
+
+/**
+ * y[i] = log(x[i]) for i < n, within 1 ulp of the exact result. Zero,
+ * negative, subnormal, infinite and nan inputs are passed to log from libm.
+ * x and y may be the same array.
+ */
+void vlog(const double *x, double *y, size_t n);
+
+#endif